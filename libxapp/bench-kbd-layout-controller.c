@@ -0,0 +1,367 @@
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <gtk/gtk.h>
+
+#include "xapp-kbd-layout-controller.h"
+#include "xapp-trace.h"
+
+/* Benchmarks XAppKbdLayoutController's reloads and getters, over group
+ * sets of 1 to N layouts, set with setxkbmap.  Run it through 'make bench'
+ * (see test-scripts/xapp-kbd-layout-controller-bench), which gives it an
+ * X server of its own, and the environment it needs:
+ *
+ * - XAPP_KBD_LAYOUT_CONTROLLER_LOCAL, so it's the in-process backend that's
+ *   measured, rendering every flag itself.
+ * - XAPP_TRACE, for the reload times - they come from the controller's
+ *   own counters, so they don't include setxkbmap, or the X server telling
+ *   gkbd about the change.
+ * - G_SLICE=always-malloc, so every allocation is counted (see below).
+ *
+ * Results are printed to stdout as a single JSON object.
+ */
+
+#define GETTER_ITERATIONS 1000
+#define RELOAD_TIMEOUT 10
+
+static const gchar * const layouts[] =
+{
+    "us", "de", "fr", "gb", "es", "it", "ru", "ua", "pl", "cz",
+    "se", "no", "fi", "dk", "nl", "pt", "br", "gr", "tr", "jp"
+};
+
+/* Every allocation in the process goes through these, so the getters'
+ * can be counted.  glibc only - the wrappers take the place of its malloc,
+ * for libxapp and GLib as much as for this file.
+ */
+extern void *__libc_malloc  (size_t size);
+extern void *__libc_calloc  (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static gint n_allocs = 0;
+
+void *
+malloc (size_t size)
+{
+    g_atomic_int_inc (&n_allocs);
+
+    return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb,
+        size_t size)
+{
+    g_atomic_int_inc (&n_allocs);
+
+    return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void   *ptr,
+         size_t  size)
+{
+    g_atomic_int_inc (&n_allocs);
+
+    return __libc_realloc (ptr, size);
+}
+
+static guint64
+get_counter (const gchar *name)
+{
+    GVariant *counters = xapp_trace_get_counters ();
+    guint64 value = 0;
+
+    g_variant_lookup (counters, name, "t", &value);
+    g_variant_unref (counters);
+
+    return value;
+}
+
+/* The peak, so differences show how much it grew, not what was freed */
+static glong
+get_max_rss_kb (void)
+{
+    struct rusage usage;
+
+    getrusage (RUSAGE_SELF, &usage);
+
+    return usage.ru_maxrss;
+}
+
+typedef struct
+{
+    GMainLoop *loop;
+    guint timeout_id;
+} ReloadWait;
+
+static gboolean
+reload_timeout (gpointer data)
+{
+    ReloadWait *wait = data;
+
+    wait->timeout_id = 0;
+    g_main_loop_quit (wait->loop);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+on_config_changed (XAppKbdLayoutController *controller,
+                   ReloadWait              *wait)
+{
+    g_main_loop_quit (wait->loop);
+}
+
+/* Returns whether the controller picked the change up */
+static gboolean
+set_groups (XAppKbdLayoutController *controller,
+            guint                    n,
+            gboolean                 duplicates)
+{
+    GString *layout_arg = g_string_new (NULL);
+    ReloadWait wait;
+    gchar *argv[4];
+    gulong handler;
+    guint i;
+    guint64 reloads;
+    GError *error = NULL;
+
+    for (i = 0; i < n; i++)
+    {
+        g_string_append_printf (layout_arg, "%s%s",
+                                i > 0 ? "," : "",
+                                layouts[duplicates ? 0 : i % G_N_ELEMENTS (layouts)]);
+    }
+
+    argv[0] = "setxkbmap";
+    argv[1] = "-layout";
+    argv[2] = layout_arg->str;
+    argv[3] = NULL;
+
+    reloads = get_counter ("reloads");
+    wait.loop = g_main_loop_new (NULL, FALSE);
+
+    handler = g_signal_connect (controller, "config-changed", G_CALLBACK (on_config_changed), &wait);
+    wait.timeout_id = g_timeout_add_seconds (RELOAD_TIMEOUT, reload_timeout, &wait);
+
+    if (g_spawn_sync (NULL, argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL, NULL, NULL, NULL, &error))
+    {
+        g_main_loop_run (wait.loop);
+    }
+    else
+    {
+        g_printerr ("Could not run setxkbmap: %s\n", error->message);
+        g_error_free (error);
+    }
+
+    if (wait.timeout_id != 0)
+    {
+        g_source_remove (wait.timeout_id);
+    }
+
+    g_signal_handler_disconnect (controller, handler);
+    g_main_loop_unref (wait.loop);
+    g_string_free (layout_arg, TRUE);
+
+    return get_counter ("reloads") > reloads;
+}
+
+typedef enum
+{
+    GETTER_SHORT_NAME_FOR_GROUP,
+    GETTER_CURRENT_NAME,
+    GETTER_ICON_FOR_GROUP,
+    GETTER_SURFACE_FOR_GROUP,
+    GETTER_ICON_NAME_FOR_GROUP,
+    GETTER_STATE,
+    N_GETTERS
+} Getter;
+
+static const gchar * const getter_names[N_GETTERS] =
+{
+    "get_short_name_for_group",
+    "get_current_name",
+    "get_icon_for_group",
+    "get_surface_for_group",
+    "get_icon_name_for_group",
+    "get_state"
+};
+
+/* Calls the getter the way a consumer would, freeing what it returns -
+ * those frees don't count, the allocations do.
+ */
+static void
+call_getter (XAppKbdLayoutController *controller,
+             Getter                   getter,
+             guint                    group)
+{
+    switch (getter)
+    {
+        case GETTER_SHORT_NAME_FOR_GROUP:
+            g_free (xapp_kbd_layout_controller_get_short_name_for_group (controller, group));
+            break;
+        case GETTER_CURRENT_NAME:
+            g_free (xapp_kbd_layout_controller_get_current_name (controller));
+            break;
+        case GETTER_ICON_FOR_GROUP:
+            {
+                GIcon *icon = xapp_kbd_layout_controller_get_icon_for_group (controller, group);
+
+                if (icon != NULL)
+                {
+                    g_object_unref (icon);
+                }
+            }
+            break;
+        case GETTER_SURFACE_FOR_GROUP:
+            {
+                cairo_surface_t *surface = xapp_kbd_layout_controller_get_surface_for_group (controller, group, 16, 1);
+
+                if (surface != NULL)
+                {
+                    cairo_surface_destroy (surface);
+                }
+            }
+            break;
+        case GETTER_ICON_NAME_FOR_GROUP:
+            g_free (xapp_kbd_layout_controller_get_icon_name_for_group (controller, group));
+            break;
+        case GETTER_STATE:
+            xapp_kbd_layout_state_unref (xapp_kbd_layout_controller_get_state (controller));
+            break;
+        case N_GETTERS:
+        default:
+            g_assert_not_reached ();
+    }
+}
+
+static void
+measure_getters (XAppKbdLayoutController *controller,
+                 guint                    group,
+                 GString                 *json)
+{
+    gboolean enabled = xapp_kbd_layout_controller_get_enabled (controller);
+    Getter getter;
+    guint i;
+
+    g_string_append (json, "\"getters\": {");
+
+    for (getter = 0; getter < N_GETTERS; getter++)
+    {
+        gint64 start;
+        gint allocs;
+
+        /* With a single layout, the state is all there is */
+        if (!enabled && getter != GETTER_STATE)
+        {
+            continue;
+        }
+
+        /* The first call may render, that's the reload's cost */
+        call_getter (controller, getter, group);
+
+        allocs = g_atomic_int_get (&n_allocs);
+        start = g_get_monotonic_time ();
+
+        for (i = 0; i < GETTER_ITERATIONS; i++)
+        {
+            call_getter (controller, getter, group);
+        }
+
+        g_string_append_printf (json, "%s\"%s\": {\"us\": %.3f, \"allocs\": %.2f}",
+                                getter > 0 && enabled ? ", " : "",
+                                getter_names[getter],
+                                (g_get_monotonic_time () - start) / (gdouble) GETTER_ITERATIONS,
+                                (g_atomic_int_get (&n_allocs) - allocs) / (gdouble) GETTER_ITERATIONS);
+    }
+
+    g_string_append (json, "}");
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+    XAppKbdLayoutController *controller;
+    GString *json;
+    guint max_groups, n;
+    gint64 start;
+    gboolean duplicates, first = TRUE;
+
+    max_groups = argc > 1 ? (guint) atoi (argv[1]) : 8;
+
+    gtk_init (&argc, &argv);
+
+    if (!xapp_trace_is_enabled ())
+    {
+        g_printerr ("%s needs XAPP_TRACE set, run it through 'make bench'\n", argv[0]);
+        return 1;
+    }
+
+    json = g_string_new ("{");
+
+    start = g_get_monotonic_time ();
+    controller = xapp_kbd_layout_controller_new ();
+
+    g_string_append_printf (json, "\"construction_ms\": %.3f, \"reloads\": [",
+                            (g_get_monotonic_time () - start) / 1000.0);
+
+    for (duplicates = FALSE; duplicates <= TRUE; duplicates++)
+    {
+        for (n = 1; n <= max_groups; n++)
+        {
+            XAppKbdLayoutState *state;
+            guint64 reload_us, bytes_written;
+            glong max_rss;
+            guint i;
+
+            /* Consumers that showed flags before get them warmed up on reload */
+            state = xapp_kbd_layout_controller_get_state (controller);
+
+            for (i = 0; i < xapp_kbd_layout_state_get_num_groups (state); i++)
+            {
+                xapp_kbd_layout_state_peek_icon (state, i);
+            }
+
+            xapp_kbd_layout_state_unref (state);
+
+            reload_us = get_counter ("reload-us");
+            bytes_written = get_counter ("icon-bytes-written");
+            max_rss = get_max_rss_kb ();
+
+            g_string_append_printf (json, "%s{\"groups\": %u, \"duplicates\": %s, ",
+                                    first ? "" : ", ", n, duplicates ? "true" : "false");
+            first = FALSE;
+
+            if (set_groups (controller, n, duplicates))
+            {
+                g_string_append_printf (json, "\"reload_ms\": %.3f, ",
+                                        (get_counter ("reload-us") - reload_us) / 1000.0);
+            }
+            else
+            {
+                g_string_append (json, "\"reload_ms\": null, ");
+            }
+
+            measure_getters (controller, n - 1, json);
+
+            g_string_append_printf (json, ", \"cache_bytes_written\": %" G_GUINT64_FORMAT
+                                          ", \"max_rss_growth_kb\": %ld}",
+                                    get_counter ("icon-bytes-written") - bytes_written,
+                                    get_max_rss_kb () - max_rss);
+        }
+    }
+
+    g_string_append (json, "]}");
+
+    g_print ("%s\n", json->str);
+
+    g_string_free (json, TRUE);
+    g_object_unref (controller);
+
+    return 0;
+}
@@ -0,0 +1,7 @@
+/* The badge compositor again, built with the plain C kernels only, so
+ * test-kbd-badge can check them even where SSE2 is available.
+ */
+#define XAPP_KBD_BADGE_NO_SIMD
+#define _xapp_kbd_badge_composite _xapp_kbd_badge_composite_scalar
+
+#include "xapp-kbd-badge.c"
@@ -0,0 +1,299 @@
+#include <config.h>
+
+#include <string.h>
+#include <math.h>
+
+#include <glib.h>
+#include <cairo.h>
+
+#include "xapp-kbd-badge.h"
+
+/* Checks the duplicate number badge compositor against the cairo code it
+ * replaced, both with and without its SSE2 kernels.
+ */
+
+/* test-kbd-badge-scalar.c */
+void _xapp_kbd_badge_composite_scalar (guchar *pixels,
+                                       gint    width,
+                                       gint    height,
+                                       gint    stride,
+                                       gint    id,
+                                       gint    offset);
+
+typedef void (* CompositeFunc) (guchar *pixels,
+                                gint    width,
+                                gint    height,
+                                gint    stride,
+                                gint    id,
+                                gint    offset);
+
+/* Per channel, in 8 bit units - the blends themselves round the same way
+ * pixman does, this only leaves room for pixman's own fast paths.
+ */
+#define TOLERANCE 2
+
+/* More sizes than the compositor keeps glyph sets for, so they get evicted
+ * and rebuilt along the way.
+ */
+static const gint heights[] = { 8, 11, 16, 21, 22, 24, 32, 48, 64 };
+
+/* Random premultiplied pixels, some opaque and some not, so the blends
+ * get checked against both.
+ */
+static cairo_surface_t *
+create_background (gint width,
+                   gint height,
+                   gint seed)
+{
+    cairo_surface_t *surface;
+    guchar *pixels;
+    gint stride, x, y;
+    GRand *rand;
+
+    surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+    pixels = cairo_image_surface_get_data (surface);
+    stride = cairo_image_surface_get_stride (surface);
+    rand = g_rand_new_with_seed (seed);
+
+    cairo_surface_flush (surface);
+
+    for (y = 0; y < height; y++)
+    {
+        guint32 *row = (guint32 *) (pixels + y * stride);
+
+        for (x = 0; x < width; x++)
+        {
+            guint a = g_rand_boolean (rand) ? 255 : g_rand_int_range (rand, 0, 256);
+            guint r = g_rand_int_range (rand, 0, a + 1);
+            guint g = g_rand_int_range (rand, 0, a + 1);
+            guint b = g_rand_int_range (rand, 0, a + 1);
+
+            row[x] = (a << 24) | (r << 16) | (g << 8) | b;
+        }
+    }
+
+    cairo_surface_mark_dirty (surface);
+
+    g_rand_free (rand);
+
+    return surface;
+}
+
+static cairo_surface_t *
+copy_surface (cairo_surface_t *source)
+{
+    cairo_surface_t *surface;
+    cairo_t *cr;
+
+    surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                          cairo_image_surface_get_width (source),
+                                          cairo_image_surface_get_height (source));
+    cr = cairo_create (surface);
+
+    cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+    cairo_set_source_surface (cr, source, 0, 0);
+    cairo_paint (cr);
+
+    cairo_destroy (cr);
+
+    return surface;
+}
+
+/* The notation as add_notation() used to draw it with cairo.  The only
+ * difference is that the pen position is rounded to whole pixels, like
+ * the compositor does on purpose (and older cairo did anyway), so the
+ * glyphs line up with its pre-rasterized ones.
+ */
+static void
+draw_reference (cairo_surface_t *surface,
+                gint             id)
+{
+    gint width, height, rx, ry, rw, rh;
+    cairo_text_extents_t ext;
+    gchar *num_string;
+    cairo_t *cr;
+
+    width = cairo_image_surface_get_width (surface);
+    height = cairo_image_surface_get_height (surface);
+
+    cr = cairo_create (surface);
+
+    rx = rw = width / 2;
+    ry = rh = height / 2;
+
+    cairo_set_source_rgba (cr, 0.0, 0.0, 0.0, .5);
+    cairo_rectangle (cr, rx, ry, rw, rh);
+    cairo_fill (cr);
+
+    cairo_set_source_rgba (cr, 1.0, 1.0, 1.0, .8);
+    cairo_rectangle (cr, rx - 1, ry - 1, rw, rh);
+    cairo_fill (cr);
+
+    cairo_set_source_rgba (cr, 0.0, 0.0, 0.0, 1.0);
+
+    num_string = g_strdup_printf ("%d", id);
+    cairo_select_font_face (cr, "sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+    cairo_set_font_size (cr, height / 2);
+
+    cairo_text_extents (cr, num_string, &ext);
+
+    cairo_move_to (cr,
+                   round (rx + (rw / 2) - (ext.width / 2) - 1),
+                   round (ry + (rh / 2) + (ext.height / 2) - 1));
+
+    cairo_show_text (cr, num_string);
+    g_free (num_string);
+
+    cairo_destroy (cr);
+    cairo_surface_flush (surface);
+}
+
+static void
+draw_composited (cairo_surface_t *surface,
+                 CompositeFunc    composite,
+                 gint             id)
+{
+    cairo_surface_flush (surface);
+
+    composite (cairo_image_surface_get_data (surface),
+               cairo_image_surface_get_width (surface),
+               cairo_image_surface_get_height (surface),
+               cairo_image_surface_get_stride (surface),
+               id,
+               1);
+
+    cairo_surface_mark_dirty (surface);
+}
+
+/* Returns the largest difference of any channel of any pixel */
+static guint
+compare_surfaces (cairo_surface_t *a,
+                  cairo_surface_t *b)
+{
+    gint width, height, x, y, shift;
+    guint max_diff = 0;
+
+    width = cairo_image_surface_get_width (a);
+    height = cairo_image_surface_get_height (a);
+
+    for (y = 0; y < height; y++)
+    {
+        const guint32 *row_a = (const guint32 *) (cairo_image_surface_get_data (a) + y * cairo_image_surface_get_stride (a));
+        const guint32 *row_b = (const guint32 *) (cairo_image_surface_get_data (b) + y * cairo_image_surface_get_stride (b));
+
+        for (x = 0; x < width; x++)
+        {
+            for (shift = 0; shift < 32; shift += 8)
+            {
+                gint ca = (row_a[x] >> shift) & 0xff;
+                gint cb = (row_b[x] >> shift) & 0xff;
+
+                max_diff = MAX (max_diff, (guint) ABS (ca - cb));
+            }
+        }
+    }
+
+    return max_diff;
+}
+
+static void
+check_against_reference (CompositeFunc composite)
+{
+    guint i;
+    gint id;
+
+    for (i = 0; i < G_N_ELEMENTS (heights); i++)
+    {
+        /* Flags are 4:3 */
+        gint height = heights[i];
+        gint width = (height * 4) / 3;
+
+        for (id = 1; id <= 9; id++)
+        {
+            cairo_surface_t *background, *expected, *actual;
+            guint diff;
+
+            background = create_background (width, height, (height << 4) | id);
+            expected = copy_surface (background);
+            actual = copy_surface (background);
+
+            draw_reference (expected, id);
+            draw_composited (actual, composite, id);
+
+            diff = compare_surfaces (expected, actual);
+
+            if (diff > TOLERANCE)
+            {
+                g_test_message ("%dx%d, id %d: channels differ by up to %u", width, height, id, diff);
+                g_test_fail ();
+            }
+
+            cairo_surface_destroy (background);
+            cairo_surface_destroy (expected);
+            cairo_surface_destroy (actual);
+        }
+    }
+}
+
+static void
+test_default (void)
+{
+#ifdef __SSE2__
+    g_test_message ("SSE2 kernels enabled");
+#else
+    g_test_message ("SSE2 not available, this is the plain C build");
+#endif
+
+    check_against_reference (_xapp_kbd_badge_composite);
+}
+
+static void
+test_scalar (void)
+{
+    check_against_reference (_xapp_kbd_badge_composite_scalar);
+}
+
+/* Both builds do the same integer math, so they have to agree exactly */
+static void
+test_simd_matches_scalar (void)
+{
+    guint i;
+    gint id;
+
+    for (i = 0; i < G_N_ELEMENTS (heights); i++)
+    {
+        gint height = heights[i];
+        gint width = (height * 4) / 3;
+
+        for (id = 1; id <= 9; id++)
+        {
+            cairo_surface_t *background, *simd, *scalar;
+
+            background = create_background (width, height, (height << 4) | id);
+            simd = copy_surface (background);
+            scalar = copy_surface (background);
+
+            draw_composited (simd, _xapp_kbd_badge_composite, id);
+            draw_composited (scalar, _xapp_kbd_badge_composite_scalar, id);
+
+            g_assert_cmpuint (compare_surfaces (simd, scalar), ==, 0);
+
+            cairo_surface_destroy (background);
+            cairo_surface_destroy (simd);
+            cairo_surface_destroy (scalar);
+        }
+    }
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/kbd-badge/default", test_default);
+    g_test_add_func ("/kbd-badge/scalar", test_scalar);
+    g_test_add_func ("/kbd-badge/simd-matches-scalar", test_simd_matches_scalar);
+
+    return g_test_run ();
+}
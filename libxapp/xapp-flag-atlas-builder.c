@@ -0,0 +1,219 @@
+/* Packs the flag PNGs into a single, pre-decoded atlas file.
+ *
+ * Usage: xapp-flag-atlas-builder <flag dir> <output file>
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "xapp-flag-atlas.h"
+
+#define ALIGN_UP(x) (((x) + XAPP_FLAG_ATLAS_ALIGN - 1) & ~(XAPP_FLAG_ATLAS_ALIGN - 1))
+
+typedef struct
+{
+    gchar *name;
+    GdkPixbuf *pixbuf;
+} FlagImage;
+
+static gint
+compare_flag_images (gconstpointer a,
+                     gconstpointer b)
+{
+    const FlagImage *fa = *(const FlagImage **) a;
+    const FlagImage *fb = *(const FlagImage **) b;
+
+    return strcmp (fa->name, fb->name);
+}
+
+static void
+flag_image_free (FlagImage *image)
+{
+    g_free (image->name);
+    g_object_unref (image->pixbuf);
+    g_slice_free (FlagImage, image);
+}
+
+/* Converts straight RGB(A) pixbuf rows to premultiplied, native-endian
+ * ARGB32, the same thing gdk_cairo_set_source_pixbuf() does.
+ */
+static void
+write_argb_rows (GdkPixbuf *pixbuf,
+                 guchar    *dest,
+                 guint      dest_stride)
+{
+    gint width, height, src_stride, n_channels, x, y;
+    const guchar *src;
+
+    width = gdk_pixbuf_get_width (pixbuf);
+    height = gdk_pixbuf_get_height (pixbuf);
+    src_stride = gdk_pixbuf_get_rowstride (pixbuf);
+    n_channels = gdk_pixbuf_get_n_channels (pixbuf);
+    src = gdk_pixbuf_get_pixels (pixbuf);
+
+    for (y = 0; y < height; y++)
+    {
+        const guchar *s = src + y * src_stride;
+        guint32 *d = (guint32 *) (dest + y * dest_stride);
+
+        for (x = 0; x < width; x++)
+        {
+            guint a = n_channels == 4 ? s[3] : 0xff;
+            guint r = (s[0] * a + 127) / 255;
+            guint g = (s[1] * a + 127) / 255;
+            guint b = (s[2] * a + 127) / 255;
+
+            d[x] = (a << 24) | (r << 16) | (g << 8) | b;
+            s += n_channels;
+        }
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+    GDir *dir;
+    const gchar *filename;
+    GPtrArray *images;
+    GError *error = NULL;
+    XAppFlagAtlasHeader header;
+    FILE *out;
+    guint32 offset;
+    guint i;
+
+    if (argc != 3)
+    {
+        g_printerr ("Usage: %s <flag dir> <output file>\n", argv[0]);
+        return 1;
+    }
+
+    dir = g_dir_open (argv[1], 0, &error);
+
+    if (dir == NULL)
+    {
+        g_printerr ("%s\n", error->message);
+        g_error_free (error);
+        return 1;
+    }
+
+    images = g_ptr_array_new_with_free_func ((GDestroyNotify) flag_image_free);
+
+    while ((filename = g_dir_read_name (dir)) != NULL)
+    {
+        FlagImage *image;
+        GdkPixbuf *pixbuf;
+        gchar *path;
+
+        if (!g_str_has_suffix (filename, ".png"))
+        {
+            continue;
+        }
+
+        if (strlen (filename) - strlen (".png") >= XAPP_FLAG_ATLAS_NAME_LEN)
+        {
+            g_printerr ("Skipping %s: name too long\n", filename);
+            continue;
+        }
+
+        path = g_build_filename (argv[1], filename, NULL);
+        pixbuf = gdk_pixbuf_new_from_file (path, &error);
+        g_free (path);
+
+        if (pixbuf == NULL)
+        {
+            g_printerr ("Skipping %s: %s\n", filename, error->message);
+            g_clear_error (&error);
+            continue;
+        }
+
+        image = g_slice_new0 (FlagImage);
+        image->name = g_strndup (filename, strlen (filename) - strlen (".png"));
+        image->pixbuf = pixbuf;
+
+        g_ptr_array_add (images, image);
+    }
+
+    g_dir_close (dir);
+
+    g_ptr_array_sort (images, compare_flag_images);
+
+    out = fopen (argv[2], "wb");
+
+    if (out == NULL)
+    {
+        g_printerr ("Could not open %s for writing\n", argv[2]);
+        g_ptr_array_unref (images);
+        return 1;
+    }
+
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, XAPP_FLAG_ATLAS_MAGIC, sizeof (header.magic));
+    header.version = XAPP_FLAG_ATLAS_VERSION;
+    header.byte_order = XAPP_FLAG_ATLAS_BYTE_ORDER;
+    header.n_entries = images->len;
+    header.index_offset = sizeof (XAppFlagAtlasHeader);
+
+    fwrite (&header, sizeof (header), 1, out);
+
+    offset = ALIGN_UP (header.index_offset + images->len * sizeof (XAppFlagAtlasEntry));
+
+    for (i = 0; i < images->len; i++)
+    {
+        FlagImage *image = g_ptr_array_index (images, i);
+        XAppFlagAtlasEntry entry;
+
+        memset (&entry, 0, sizeof (entry));
+        strncpy (entry.name, image->name, XAPP_FLAG_ATLAS_NAME_LEN - 1);
+        entry.width = gdk_pixbuf_get_width (image->pixbuf);
+        entry.height = gdk_pixbuf_get_height (image->pixbuf);
+        entry.stride = ALIGN_UP (entry.width * 4);
+        entry.data_offset = offset;
+
+        fwrite (&entry, sizeof (entry), 1, out);
+
+        offset = ALIGN_UP (offset + entry.stride * entry.height);
+    }
+
+    offset = header.index_offset + images->len * sizeof (XAppFlagAtlasEntry);
+
+    for (i = 0; i < images->len; i++)
+    {
+        FlagImage *image = g_ptr_array_index (images, i);
+        guint32 stride, size, padding;
+        guchar *pixels;
+
+        padding = ALIGN_UP (offset) - offset;
+        offset += padding;
+
+        while (padding-- > 0)
+        {
+            fputc (0, out);
+        }
+
+        stride = ALIGN_UP (gdk_pixbuf_get_width (image->pixbuf) * 4);
+        size = stride * gdk_pixbuf_get_height (image->pixbuf);
+
+        pixels = g_malloc0 (size);
+        write_argb_rows (image->pixbuf, pixels, stride);
+        fwrite (pixels, size, 1, out);
+        g_free (pixels);
+
+        offset += size;
+    }
+
+    g_ptr_array_unref (images);
+
+    if (fclose (out) != 0)
+    {
+        g_printerr ("Could not write %s\n", argv[2]);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,167 @@
+#include <config.h>
+
+#include <string.h>
+
+#include <glib.h>
+#include <cairo.h>
+
+#include "xapp-flag-atlas.h"
+
+/* cairo's limit for image surfaces - it also keeps width * 4 from
+ * overflowing.
+ */
+#define FLAG_ATLAS_MAX_SIZE 32767
+
+struct _XAppFlagAtlas
+{
+    GMappedFile *file;
+    GHashTable *index;
+};
+
+G_LOCK_DEFINE_STATIC (default_atlas);
+static XAppFlagAtlas *default_atlas = NULL;
+static gboolean default_atlas_loaded = FALSE;
+
+static XAppFlagAtlas *
+flag_atlas_load (const gchar *path)
+{
+    GMappedFile *file;
+    const gchar *contents;
+    gsize length;
+    const XAppFlagAtlasHeader *header;
+    XAppFlagAtlas *atlas;
+    guint i;
+
+    file = g_mapped_file_new (path, FALSE, NULL);
+
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    contents = g_mapped_file_get_contents (file);
+    length = g_mapped_file_get_length (file);
+
+    if (length < sizeof (XAppFlagAtlasHeader))
+    {
+        goto invalid;
+    }
+
+    header = (const XAppFlagAtlasHeader *) contents;
+
+    if (memcmp (header->magic, XAPP_FLAG_ATLAS_MAGIC, sizeof (header->magic)) != 0 ||
+        header->version != XAPP_FLAG_ATLAS_VERSION ||
+        header->byte_order != XAPP_FLAG_ATLAS_BYTE_ORDER)
+    {
+        goto invalid;
+    }
+
+    if (header->index_offset > length ||
+        header->n_entries > (length - header->index_offset) / sizeof (XAppFlagAtlasEntry))
+    {
+        goto invalid;
+    }
+
+    atlas = g_slice_new0 (XAppFlagAtlas);
+    atlas->file = file;
+    atlas->index = g_hash_table_new (g_str_hash, g_str_equal);
+
+    for (i = 0; i < header->n_entries; i++)
+    {
+        const XAppFlagAtlasEntry *entry;
+
+        entry = (const XAppFlagAtlasEntry *) (contents + header->index_offset) + i;
+
+        /* Skipped entries aren't found, so those flags come from the
+         * png directory instead.
+         */
+        if (entry->name[XAPP_FLAG_ATLAS_NAME_LEN - 1] != '\0' ||
+            entry->width == 0 || entry->width > FLAG_ATLAS_MAX_SIZE ||
+            entry->height == 0 || entry->height > FLAG_ATLAS_MAX_SIZE ||
+            entry->stride % 4 != 0 ||
+            entry->stride < entry->width * 4 ||
+            entry->data_offset % XAPP_FLAG_ATLAS_ALIGN != 0 ||
+            entry->data_offset > length ||
+            (guint64) entry->stride * entry->height > length - entry->data_offset)
+        {
+            g_warning ("Skipping corrupt flag atlas entry %u in %s", i, path);
+            continue;
+        }
+
+        g_hash_table_insert (atlas->index, (gpointer) entry->name, (gpointer) entry);
+    }
+
+    return atlas;
+
+invalid:
+    g_warning ("Ignoring invalid flag atlas %s", path);
+    g_mapped_file_unref (file);
+
+    return NULL;
+}
+
+/* The atlas is mapped read-only once per process, and lives until exit,
+ * so the pages are shared with every other process using libxapp.
+ * Returns NULL if no atlas is installed.
+ */
+XAppFlagAtlas *
+_xapp_flag_atlas_get_default (void)
+{
+    G_LOCK (default_atlas);
+
+    if (!default_atlas_loaded)
+    {
+        const char * const * data_dirs;
+        gint i;
+
+        data_dirs = g_get_system_data_dirs ();
+
+        for (i = 0; data_dirs[i] != NULL && default_atlas == NULL; i++)
+        {
+            gchar *try_path = g_build_filename (data_dirs[i], "xapps", XAPP_FLAG_ATLAS_FILENAME, NULL);
+
+            if (g_file_test (try_path, G_FILE_TEST_EXISTS))
+            {
+                default_atlas = flag_atlas_load (try_path);
+            }
+
+            g_free (try_path);
+        }
+
+        default_atlas_loaded = TRUE;
+    }
+
+    G_UNLOCK (default_atlas);
+
+    return default_atlas;
+}
+
+/* Returns a cairo surface wrapping the mapped pixels of the named flag,
+ * or NULL if the atlas doesn't contain it.  No pixels are copied - the
+ * surface must only ever be used as a source, since the underlying pages
+ * are read-only.
+ */
+cairo_surface_t *
+_xapp_flag_atlas_lookup_surface (XAppFlagAtlas *atlas,
+                                 const gchar   *name)
+{
+    const XAppFlagAtlasEntry *entry;
+    const gchar *contents;
+
+    g_return_val_if_fail (atlas != NULL, NULL);
+
+    entry = g_hash_table_lookup (atlas->index, name);
+
+    if (entry == NULL)
+    {
+        return NULL;
+    }
+
+    contents = g_mapped_file_get_contents (atlas->file);
+
+    return cairo_image_surface_create_for_data ((guchar *) contents + entry->data_offset,
+                                                CAIRO_FORMAT_ARGB32,
+                                                entry->width,
+                                                entry->height,
+                                                entry->stride);
+}
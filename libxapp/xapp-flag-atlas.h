@@ -0,0 +1,52 @@
+#ifndef __XAPP_FLAG_ATLAS_H__
+#define __XAPP_FLAG_ATLAS_H__
+
+#include <glib.h>
+#include <cairo.h>
+
+G_BEGIN_DECLS
+
+/* On-disk layout of the flag atlas generated at build time by
+ * xapp-flag-atlas-builder from the PNGs in xapps/flags.
+ *
+ * The file is a header, followed by n_entries index records, followed
+ * by the pixel data.  Pixels are stored as premultiplied, native-endian
+ * ARGB32 (CAIRO_FORMAT_ARGB32), so they can be handed to cairo as-is.
+ * Every image starts on a XAPP_FLAG_ATLAS_ALIGN boundary.
+ */
+
+#define XAPP_FLAG_ATLAS_MAGIC      "XAPPFLAG"
+#define XAPP_FLAG_ATLAS_VERSION    1
+#define XAPP_FLAG_ATLAS_BYTE_ORDER 0x01020304
+#define XAPP_FLAG_ATLAS_NAME_LEN   16
+#define XAPP_FLAG_ATLAS_ALIGN      16
+#define XAPP_FLAG_ATLAS_FILENAME   "flags.atlas"
+
+typedef struct
+{
+    gchar   magic[8];
+    guint32 version;
+    guint32 byte_order;
+    guint32 n_entries;
+    guint32 index_offset;
+    guint32 reserved[2];
+} XAppFlagAtlasHeader;
+
+typedef struct
+{
+    gchar   name[XAPP_FLAG_ATLAS_NAME_LEN];
+    guint32 width;
+    guint32 height;
+    guint32 stride;
+    guint32 data_offset;
+} XAppFlagAtlasEntry;
+
+typedef struct _XAppFlagAtlas XAppFlagAtlas;
+
+XAppFlagAtlas   *_xapp_flag_atlas_get_default    (void);
+cairo_surface_t *_xapp_flag_atlas_lookup_surface (XAppFlagAtlas *atlas,
+                                                  const gchar   *name);
+
+G_END_DECLS
+
+#endif  /* __XAPP_FLAG_ATLAS_H__ */
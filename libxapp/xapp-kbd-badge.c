@@ -0,0 +1,460 @@
+#include <config.h>
+
+#include <string.h>
+#include <math.h>
+
+#include <glib.h>
+#include <cairo.h>
+
+/* XAPP_KBD_BADGE_NO_SIMD forces the plain C kernels, so the test can
+ * check both.
+ */
+#if defined (__SSE2__) && !defined (XAPP_KBD_BADGE_NO_SIMD)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "xapp-kbd-badge.h"
+
+/* Draws the duplicate number badge of a layout flag straight onto its
+ * premultiplied ARGB32 rows.  The result matches what the old cairo
+ * version (two translucent rectangles and the number in bold "sans")
+ * produced, but the digits are rasterized once per font size (and kept
+ * for the last few sizes), and everything else is a plain blend over the
+ * pixels.
+ */
+
+/* Premultiplied ARGB32 */
+#define BADGE_SHADOW_COLOR 0x80000000   /* black, alpha .5 */
+#define BADGE_FILL_COLOR   0xcccccccc   /* white, alpha .8 */
+#define BADGE_TEXT_COLOR   0xff000000   /* black */
+
+/* Glyph sets kept around - enough for the sizes a few panels at a few
+ * scales use, without growing for every height we're ever asked for.
+ */
+#define GLYPH_SET_CACHE_SIZE 4
+
+#define DIV255(x) ((((x) + 128) + (((x) + 128) >> 8)) >> 8)
+
+typedef struct
+{
+    guchar *mask;
+    gint stride;
+    gint width;
+    gint height;
+
+    /* Position of the mask relative to the glyph origin */
+    gint left;
+    gint top;
+
+    cairo_text_extents_t extents;
+} DigitGlyph;
+
+typedef struct
+{
+    gint ref_count;
+    gint font_size;
+
+    DigitGlyph digits[10];
+} DigitGlyphSet;
+
+/* Most recently used first */
+G_LOCK_DEFINE_STATIC (glyph_sets);
+static GQueue glyph_sets = G_QUEUE_INIT;
+
+static void
+rasterize_digit (cairo_t    *measure_cr,
+                 gint        font_size,
+                 gint        digit,
+                 DigitGlyph *glyph)
+{
+    cairo_surface_t *surface;
+    cairo_t *cr;
+    gchar text[2] = { '0' + digit, '\0' };
+
+    cairo_text_extents (measure_cr, text, &glyph->extents);
+
+    glyph->left = (gint) floor (glyph->extents.x_bearing);
+    glyph->top = (gint) floor (glyph->extents.y_bearing);
+    glyph->width = (gint) ceil (glyph->extents.x_bearing + glyph->extents.width) - glyph->left;
+    glyph->height = (gint) ceil (glyph->extents.y_bearing + glyph->extents.height) - glyph->top;
+
+    if (glyph->width <= 0 || glyph->height <= 0)
+    {
+        glyph->width = glyph->height = 0;
+        glyph->mask = NULL;
+        return;
+    }
+
+    glyph->stride = cairo_format_stride_for_width (CAIRO_FORMAT_A8, glyph->width);
+    glyph->mask = g_malloc0 (glyph->stride * glyph->height);
+
+    surface = cairo_image_surface_create_for_data (glyph->mask,
+                                                   CAIRO_FORMAT_A8,
+                                                   glyph->width,
+                                                   glyph->height,
+                                                   glyph->stride);
+    cr = cairo_create (surface);
+
+    cairo_select_font_face (cr, "sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+    cairo_set_font_size (cr, font_size);
+    cairo_move_to (cr, -glyph->left, -glyph->top);
+    cairo_show_text (cr, text);
+
+    cairo_destroy (cr);
+    cairo_surface_flush (surface);
+    cairo_surface_destroy (surface);
+}
+
+static void
+glyph_set_unref (DigitGlyphSet *set)
+{
+    gint i;
+
+    if (!g_atomic_int_dec_and_test (&set->ref_count))
+    {
+        return;
+    }
+
+    for (i = 0; i < 10; i++)
+    {
+        g_free (set->digits[i].mask);
+    }
+
+    g_free (set);
+}
+
+static DigitGlyphSet *
+glyph_set_new (gint font_size)
+{
+    DigitGlyphSet *set;
+    cairo_surface_t *surface;
+    cairo_t *cr;
+    gint i;
+
+    surface = cairo_image_surface_create (CAIRO_FORMAT_A8, 1, 1);
+    cr = cairo_create (surface);
+
+    cairo_select_font_face (cr, "sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+    cairo_set_font_size (cr, font_size);
+
+    set = g_new0 (DigitGlyphSet, 1);
+    set->ref_count = 1;
+    set->font_size = font_size;
+
+    for (i = 0; i < 10; i++)
+    {
+        rasterize_digit (cr, font_size, i, &set->digits[i]);
+    }
+
+    cairo_destroy (cr);
+    cairo_surface_destroy (surface);
+
+    return set;
+}
+
+/* Returns a reference to the glyph set for font_size, from the last
+ * GLYPH_SET_CACHE_SIZE used ones if possible.  Release it with
+ * glyph_set_unref().
+ */
+static DigitGlyphSet *
+get_glyph_set (gint font_size)
+{
+    DigitGlyphSet *set = NULL;
+    GList *l;
+
+    G_LOCK (glyph_sets);
+
+    for (l = glyph_sets.head; l != NULL; l = l->next)
+    {
+        if (((DigitGlyphSet *) l->data)->font_size == font_size)
+        {
+            set = l->data;
+            g_queue_unlink (&glyph_sets, l);
+            g_queue_push_head_link (&glyph_sets, l);
+            break;
+        }
+    }
+
+    if (set == NULL)
+    {
+        set = glyph_set_new (font_size);
+        g_queue_push_head (&glyph_sets, set);
+
+        while (g_queue_get_length (&glyph_sets) > GLYPH_SET_CACHE_SIZE)
+        {
+            glyph_set_unref (g_queue_pop_tail (&glyph_sets));
+        }
+    }
+
+    g_atomic_int_inc (&set->ref_count);
+
+    G_UNLOCK (glyph_sets);
+
+    return set;
+}
+
+/* Porter-Duff OVER of color, scaled by coverage, onto one premultiplied pixel */
+static inline guint32
+blend_pixel (guint32 dst,
+             guint32 color,
+             guint   coverage)
+{
+    guint32 result = 0;
+    guint src_alpha;
+    gint shift;
+
+    src_alpha = DIV255 ((color >> 24) * coverage);
+
+    for (shift = 0; shift < 32; shift += 8)
+    {
+        guint s = DIV255 (((color >> shift) & 0xff) * coverage);
+        guint d = (dst >> shift) & 0xff;
+
+        result |= (s + DIV255 (d * (255 - src_alpha))) << shift;
+    }
+
+    return result;
+}
+
+#ifdef USE_SSE2
+/* Exact x / 255, rounded, for 0 <= x <= 255 * 255 */
+static inline __m128i
+div255_epu16 (__m128i x)
+{
+    x = _mm_add_epi16 (x, _mm_set1_epi16 (128));
+
+    return _mm_srli_epi16 (_mm_add_epi16 (x, _mm_srli_epi16 (x, 8)), 8);
+}
+
+/* Two pixels, one 16 bit lane per channel */
+static inline __m128i
+blend_pixels_epu16 (__m128i dst,
+                    __m128i color,
+                    __m128i coverage)
+{
+    __m128i src, alpha, inv_alpha;
+
+    src = div255_epu16 (_mm_mullo_epi16 (color, coverage));
+
+    alpha = _mm_shufflelo_epi16 (src, _MM_SHUFFLE (3, 3, 3, 3));
+    alpha = _mm_shufflehi_epi16 (alpha, _MM_SHUFFLE (3, 3, 3, 3));
+    inv_alpha = _mm_sub_epi16 (_mm_set1_epi16 (255), alpha);
+
+    return _mm_add_epi16 (src, div255_epu16 (_mm_mullo_epi16 (dst, inv_alpha)));
+}
+#endif
+
+/* Blends color over n pixels, with per-pixel coverage from mask, or a
+ * constant coverage if mask is NULL.
+ */
+static void
+blend_span (guint32      *dst,
+            const guchar *mask,
+            guint         coverage,
+            gint          n,
+            guint32       color)
+{
+    gint i = 0;
+
+#ifdef USE_SSE2
+    const __m128i zero = _mm_setzero_si128 ();
+    const __m128i color16 = _mm_unpacklo_epi8 (_mm_set1_epi32 ((gint) color), zero);
+    __m128i cov_lo, cov_hi;
+
+    cov_lo = cov_hi = _mm_set1_epi16 ((gshort) coverage);
+
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i d, lo, hi;
+
+        if (mask != NULL)
+        {
+            guint32 m;
+            __m128i m8;
+
+            memcpy (&m, mask + i, sizeof (m));
+
+            if (m == 0)
+            {
+                continue;
+            }
+
+            /* m0 m1 m2 m3 -> m0 x4, m1 x4, m2 x4, m3 x4 */
+            m8 = _mm_cvtsi32_si128 ((gint) m);
+            m8 = _mm_unpacklo_epi8 (m8, m8);
+            m8 = _mm_unpacklo_epi16 (m8, m8);
+
+            cov_lo = _mm_unpacklo_epi8 (m8, zero);
+            cov_hi = _mm_unpackhi_epi8 (m8, zero);
+        }
+
+        d = _mm_loadu_si128 ((const __m128i *) (dst + i));
+
+        lo = blend_pixels_epu16 (_mm_unpacklo_epi8 (d, zero), color16, cov_lo);
+        hi = blend_pixels_epu16 (_mm_unpackhi_epi8 (d, zero), color16, cov_hi);
+
+        _mm_storeu_si128 ((__m128i *) (dst + i), _mm_packus_epi16 (lo, hi));
+    }
+#endif
+
+    for (; i < n; i++)
+    {
+        guint c = mask != NULL ? mask[i] : coverage;
+
+        if (c != 0)
+        {
+            dst[i] = blend_pixel (dst[i], color, c);
+        }
+    }
+}
+
+static void
+fill_rect (guchar  *pixels,
+           gint     width,
+           gint     height,
+           gint     stride,
+           gint     x,
+           gint     y,
+           gint     w,
+           gint     h,
+           guint32  color)
+{
+    gint x0, x1, y0, y1, row;
+
+    x0 = MAX (x, 0);
+    y0 = MAX (y, 0);
+    x1 = MIN (x + w, width);
+    y1 = MIN (y + h, height);
+
+    if (x0 >= x1)
+    {
+        return;
+    }
+
+    for (row = y0; row < y1; row++)
+    {
+        blend_span ((guint32 *) (pixels + row * stride) + x0, NULL, 255, x1 - x0, color);
+    }
+}
+
+static void
+draw_glyph (guchar           *pixels,
+            gint              width,
+            gint              height,
+            gint              stride,
+            const DigitGlyph *glyph,
+            gint              gx,
+            gint              gy)
+{
+    gint x0, x1, row;
+
+    if (glyph->mask == NULL)
+    {
+        return;
+    }
+
+    x0 = MAX (gx, 0);
+    x1 = MIN (gx + glyph->width, width);
+
+    if (x0 >= x1)
+    {
+        return;
+    }
+
+    for (row = MAX (gy, 0); row < MIN (gy + glyph->height, height); row++)
+    {
+        blend_span ((guint32 *) (pixels + row * stride) + x0,
+                    glyph->mask + (row - gy) * glyph->stride + (x0 - gx),
+                    255,
+                    x1 - x0,
+                    BADGE_TEXT_COLOR);
+    }
+}
+
+/* Lays out the digits of id like cairo_show_text() would, centered (by
+ * ink extents) on cx, cy.
+ */
+static void
+draw_number (guchar *pixels,
+             gint    width,
+             gint    height,
+             gint    stride,
+             gint    cx,
+             gint    cy,
+             gint    id,
+             gint    offset)
+{
+    DigitGlyphSet *set;
+    gdouble min_x, max_x, min_y, max_y, pen, origin_x, origin_y;
+    gchar digits[16];
+    gint i;
+
+    set = get_glyph_set (height / 2);
+
+    g_snprintf (digits, sizeof (digits), "%d", id);
+
+    min_x = min_y = G_MAXDOUBLE;
+    max_x = max_y = -G_MAXDOUBLE;
+    pen = 0;
+
+    for (i = 0; digits[i] != '\0'; i++)
+    {
+        const cairo_text_extents_t *ext = &set->digits[digits[i] - '0'].extents;
+
+        min_x = MIN (min_x, pen + ext->x_bearing);
+        max_x = MAX (max_x, pen + ext->x_bearing + ext->width);
+        min_y = MIN (min_y, ext->y_bearing);
+        max_y = MAX (max_y, ext->y_bearing + ext->height);
+
+        pen += ext->x_advance;
+    }
+
+    if (max_x < min_x)
+    {
+        glyph_set_unref (set);
+        return;
+    }
+
+    origin_x = cx - ((max_x - min_x) / 2) - offset;
+    origin_y = cy + ((max_y - min_y) / 2) - offset;
+
+    pen = 0;
+
+    for (i = 0; digits[i] != '\0'; i++)
+    {
+        const DigitGlyph *glyph = &set->digits[digits[i] - '0'];
+
+        draw_glyph (pixels, width, height, stride,
+                    glyph,
+                    (gint) round (origin_x + pen) + glyph->left,
+                    (gint) round (origin_y) + glyph->top);
+
+        pen += glyph->extents.x_advance;
+    }
+
+    glyph_set_unref (set);
+}
+
+/* Draws the duplicate number badge over the bottom right quarter of a
+ * width x height image.  offset is the size of the badge's drop shadow,
+ * in pixels.
+ */
+void
+_xapp_kbd_badge_composite (guchar *pixels,
+                           gint    width,
+                           gint    height,
+                           gint    stride,
+                           gint    id,
+                           gint    offset)
+{
+    gint rx, ry, rw, rh;
+
+    rx = rw = width / 2;
+    ry = rh = height / 2;
+
+    fill_rect (pixels, width, height, stride, rx, ry, rw, rh, BADGE_SHADOW_COLOR);
+    fill_rect (pixels, width, height, stride, rx - offset, ry - offset, rw, rh, BADGE_FILL_COLOR);
+
+    draw_number (pixels, width, height, stride, rx + (rw / 2), ry + (rh / 2), id, offset);
+}
@@ -0,0 +1,17 @@
+#ifndef __XAPP_KBD_BADGE_H__
+#define __XAPP_KBD_BADGE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+void _xapp_kbd_badge_composite (guchar *pixels,
+                                gint    width,
+                                gint    height,
+                                gint    stride,
+                                gint    id,
+                                gint    offset);
+
+G_END_DECLS
+
+#endif  /* __XAPP_KBD_BADGE_H__ */
@@ -8,12 +8,49 @@
 
 #include <glib/gstdio.h>
 #include <gdk/gdk.h>
+#include <gdk/gdkx.h>
 #include <gtk/gtk.h>
 #include <cairo.h>
 
+#include <X11/XKBlib.h>
+
 #include <libgnomekbd/gkbd-configuration.h>
 
 #include "xapp-kbd-layout-controller.h"
+#include "xapp-kbd-layout-item.h"
+#include "xapp-kbd-layout-item-private.h"
+#include "xapp-kbd-layout-dbus.h"
+#include "xapp-flag-atlas.h"
+#include "xapp-kbd-badge.h"
+#include "xapp-trace-private.h"
+
+/* Bump whenever the rendered output changes, so stale cache entries
+ * are never picked up again (they'll be evicted eventually).
+ */
+#define ICON_CACHE_RENDERER_VERSION 2
+#define ICON_CACHE_PREFIX "xapp-kbd-layout-"
+#define ICON_CACHE_MAX_SIZE (2 * 1024 * 1024)
+/* Other processes share the cache and may have handed out names of icons
+ * we can't see being used, so nothing younger than this is evicted.
+ */
+#define ICON_CACHE_MIN_AGE (24 * 60 * 60)
+
+#define SURFACE_CACHE_MAX_ENTRIES 16
+/* How long a worker waits on the service for a flag, in ms */
+#define GET_ICON_TIMEOUT 2000
+/* In device pixels - way past any sane icon, but keeps a bad size from
+ * asking cairo for gigabytes (or overflowing the width).
+ */
+#define SURFACE_MAX_SIZE 1024
+/* How long a group switch may take to come back before we stop waiting
+ * for it, in ms - past that it's been lost, or overridden by someone else.
+ */
+#define SWITCH_TIMEOUT 1000
+/* How often retired snapshots are retried while readers are still taking
+ * references, in ms - that's only ever a few instructions, so it hardly
+ * ever takes more than one retry.
+ */
+#define RETIRE_RETRY_INTERVAL 10
 
 enum
 {
@@ -21,6 +58,9 @@ enum
 
   PROP_ENABLED,
   PROP_USE_CAPS,
+  PROP_CURRENT_GROUP,
+  PROP_COALESCE_INTERVAL,
+  PROP_INIT_ASYNC,
 };
 
 enum
@@ -33,54 +73,143 @@ enum
 
 static guint signals[LAST_SIGNAL] = { 0, };
 
+typedef struct _LayoutStore LayoutStore;
+typedef struct _LayoutBackend LayoutBackend;
+
 struct _XAppKbdLayoutControllerPrivate
 {
+    LayoutBackend *backend;
+
+    GListStore *model;
+    LayoutStore *model_store;
+
+    /* layout-changed coalescing, off when the interval is 0 */
+    guint coalesce_interval;
+    guint coalesce_id;
+    gboolean coalesce_pending;
+    guint emitted_group;
+
+    /* Constructed by xapp_kbd_layout_controller_new_async(), so the
+     * backend is left for init_async to attach.
+     */
+    gboolean init_async;
+};
+
+/* Everything that doesn't depend on the consumer - the gkbd listener (or
+ * service proxy), the current store and the caches.  One backend is
+ * shared by all the controllers in a process, which are only views
+ * forwarding its changes, so N controllers still cost one listener and
+ * one render.  Only ever used from the main thread.
+ */
+struct _LayoutBackend
+{
+    gint ref_count;
+
+    /* Exactly one of these is set - the proxy when the session service
+     * is available, and our own gkbd listener otherwise.
+     */
     GkbdConfiguration *config;
+    GDBusProxy *proxy;
 
     gint num_groups;
-    gchar *flag_dir;
+    guint current_group;
+    gboolean enabled;
+
     gchar *temp_flag_theme_dir;
+    gboolean icon_theme_initialized;
 
-    gchar *icon_names[4];
-    gchar *text_store[4];
+    LayoutStore *store;
+    GCancellable *reload_cancellable;
+
+    /* The current snapshot, read locklessly from any thread.  Replaced
+     * snapshots are only released once no reader is between loading the
+     * pointer and taking its reference.
+     */
+    XAppKbdLayoutState *state;
+    gint readers;
+    GSList *retired;
+    guint retire_id;
+
+    GQueue *surface_cache;
+    GArray *changed_groups;
 
-    gulong changed_id;
-    gulong group_changed_id;
     guint idle_changed_id;
 
-    gboolean enabled;
+    /* The group we last asked for and when, until the switch comes back
+     * (or times out), and how long the last one took to.
+     */
+    guint requested_group;
+    gint64 switch_requested;
+    gint64 switch_latency;
+    guint switch_timeout_id;
+
+    /* Not referenced - controllers remove themselves when disposed */
+    GList *controllers;
 };
 
-G_DEFINE_TYPE (XAppKbdLayoutController, xapp_kbd_layout_controller, G_TYPE_OBJECT);
+static LayoutBackend *default_backend = NULL;
 
-static void
-initialize_flag_dir (XAppKbdLayoutController *controller)
-{
-    XAppKbdLayoutControllerPrivate *priv = controller->priv;
-    gint i;
+/* Asynchronous inits waiting for the default backend to be created, and
+ * whether it's on its way (the inits may all have been cancelled since).
+ */
+static GList *pending_inits = NULL;
+static gboolean creating_backend = FALSE;
+
+static void xapp_kbd_layout_controller_initable_iface_init (GInitableIface *iface);
+static void xapp_kbd_layout_controller_async_initable_iface_init (GAsyncInitableIface *iface);
 
-    const char * const * data_dirs;
+G_DEFINE_TYPE_WITH_CODE (XAppKbdLayoutController, xapp_kbd_layout_controller, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_INITABLE,
+                                                xapp_kbd_layout_controller_initable_iface_init)
+                         G_IMPLEMENT_INTERFACE (G_TYPE_ASYNC_INITABLE,
+                                                xapp_kbd_layout_controller_async_initable_iface_init));
 
-    data_dirs = g_get_system_data_dirs ();
+/* The png directory is only used for flags the pre-decoded atlas doesn't
+ * have (or if it's not installed at all).  Both are looked up the first
+ * time a flag is rendered, from whichever thread that happens on.
+ */
+static const gchar *
+get_flag_dir (void)
+{
+    static gsize initialized = 0;
+    static gchar *flag_dir = NULL;
 
-    for (i = 0; data_dirs[i] != NULL; i++)
+    if (g_once_init_enter (&initialized))
     {
-        gchar *try_path = g_build_filename (data_dirs[i], "xapps", "flags", NULL);
+        const char * const * data_dirs;
+        gint i;
 
-        if (g_file_test (try_path, G_FILE_TEST_EXISTS))
+        data_dirs = g_get_system_data_dirs ();
+
+        for (i = 0; data_dirs[i] != NULL; i++)
         {
-            priv->flag_dir = g_strdup (try_path);
-            break;
+            gchar *try_path = g_build_filename (data_dirs[i], "xapps", "flags", NULL);
+
+            if (g_file_test (try_path, G_FILE_TEST_EXISTS))
+            {
+                flag_dir = try_path;
+                break;
+            }
+
+            g_free (try_path);
         }
 
-        g_free (try_path);
+        g_once_init_leave (&initialized, 1);
     }
+
+    return flag_dir;
 }
 
 static void
-initialize_icon_theme (XAppKbdLayoutController *controller)
+initialize_icon_theme (LayoutBackend *backend)
 {
-    XAppKbdLayoutControllerPrivate *priv = controller->priv;
+    /* Only set up when someone first asks for an icon name - consumers
+     * of the in-memory icons never touch the disk or the icon theme.
+     */
+    if (backend->icon_theme_initialized)
+    {
+        return;
+    }
 
     const gchar *cache_dir = g_get_user_cache_dir ();
 
@@ -88,44 +217,100 @@ initialize_icon_theme (XAppKbdLayoutController *controller)
 
     g_mkdir_with_parents (path, 0700);
 
-    priv->temp_flag_theme_dir = path;
+    backend->temp_flag_theme_dir = path;
 
     gtk_icon_theme_append_search_path (gtk_icon_theme_get_default (), path);
-}
-
-static void
-clear_stores (XAppKbdLayoutController *controller)
-{
-    XAppKbdLayoutControllerPrivate *priv = controller->priv;
-
-    gint i;
 
-    for (i = 0; i < 4; i++)
-    {
-        g_clear_pointer (&priv->text_store[i], g_free);
-        g_clear_pointer (&priv->icon_names[i], g_free);
-    }
+    backend->icon_theme_initialized = TRUE;
 }
 
 typedef struct
 {
     gchar *group;
     gint id;
+
+    gchar *text;
+    gchar *icon_name;
+    GdkPixbuf *pixbuf;
+    gboolean pixbuf_tried;
 } GroupData;
 
 static void
 group_data_free (GroupData *data)
 {
     g_clear_pointer (&data->group, g_free);
+    g_clear_pointer (&data->text, g_free);
+    g_clear_pointer (&data->icon_name, g_free);
+    g_clear_object (&data->pixbuf);
     data->id = 0;
 
     g_slice_free (GroupData, data);
 }
 
+/* Everything derived from one configuration.  A store is built completely
+ * (possibly on a worker thread) before it's handed to the controller, and
+ * only ever touched from the main thread after that.  It's refcounted so
+ * XAppKbdLayoutState snapshots can share it.
+ */
+struct _LayoutStore
+{
+    gint ref_count;
+
+    gint num_groups;
+    GPtrArray *groups;
+    gchar **full_names;
+
+    GDBusProxy *proxy;
+
+    /* Flags are rendered on first use, possibly from several threads at
+     * once through XAppKbdLayoutState - this serializes the rendering.
+     */
+    GMutex render_lock;
+
+    gboolean icons_used;
+    gboolean icon_names_saved;
+    gboolean fetch_claimed;
+    gboolean new_icon_names;
+};
+
+/* Only the current group is the snapshot's own - a group switch publishes
+ * a new one of these, sharing the store, which isn't touched.
+ */
+struct _XAppKbdLayoutState
+{
+    gint ref_count;
+
+    LayoutStore *store;
+    guint current_group;
+};
+
+static LayoutStore *
+layout_store_ref (LayoutStore *store)
+{
+    g_atomic_int_inc (&store->ref_count);
+
+    return store;
+}
+
+static void
+layout_store_unref (LayoutStore *store)
+{
+    if (!g_atomic_int_dec_and_test (&store->ref_count))
+    {
+        return;
+    }
+
+    g_clear_pointer (&store->groups, g_ptr_array_unref);
+    g_clear_pointer (&store->full_names, g_strfreev);
+    g_clear_object (&store->proxy);
+    g_mutex_clear (&store->render_lock);
+
+    g_slice_free (LayoutStore, store);
+}
+
 static gchar *
-create_text (XAppKbdLayoutController *controller,
-             const gchar             *name,
-             gint                     id)
+create_text (const gchar *name,
+             gint         id)
 {
     if (g_utf8_validate (name, -1, NULL))
     {
@@ -142,7 +327,15 @@ create_text (XAppKbdLayoutController *controller,
 
         if (id > 0)
         {
-            string = g_string_append_unichar (string, 0x2080 + id);
+            gchar digits[16];
+            gint i;
+
+            g_snprintf (digits, sizeof (digits), "%d", id);
+
+            for (i = 0; digits[i] != '\0'; i++)
+            {
+                string = g_string_append_unichar (string, 0x2080 + (digits[i] - '0'));
+            }
         }
 
         return g_string_free (string, FALSE);
@@ -151,233 +344,2137 @@ create_text (XAppKbdLayoutController *controller,
     return NULL;
 }
 
-static GdkPixbuf *
-add_notation (GdkPixbuf *original, gint id)
+static cairo_surface_t *
+load_flag_surface (const gchar *name)
 {
-    gint width, height;
+    XAppFlagAtlas *atlas;
+    const gchar *flag_dir;
     cairo_surface_t *surface;
+    GdkPixbuf *pixbuf;
     cairo_t *cr;
+    gint64 trace_start = _xapp_trace_span_begin ();
 
-    width = gdk_pixbuf_get_width (original);
-    height = gdk_pixbuf_get_height (original);
+    atlas = _xapp_flag_atlas_get_default ();
 
-    surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
-    
-    if (surface == NULL)
+    if (atlas != NULL)
     {
-        return original;
+        surface = _xapp_flag_atlas_lookup_surface (atlas, name);
+
+        if (surface != NULL)
+        {
+            _xapp_trace_span (XAPP_TRACE_FLAG_LOAD_TIME, trace_start);
+            return surface;
+        }
     }
 
-    cr = cairo_create (surface);
+    flag_dir = get_flag_dir ();
 
-    gdk_cairo_set_source_pixbuf (cr, original, 0, 0);
-    cairo_paint (cr);
+    if (flag_dir == NULL)
+    {
+        return NULL;
+    }
 
-    gint rx, ry, rw, rh;
+    gchar *filename = g_strdup_printf ("%s.png", name);
+    gchar *full_path = g_build_filename (flag_dir, filename, NULL);
 
-    rx = rw = width / 2;
-    ry = rh = height / 2;
+    pixbuf = gdk_pixbuf_new_from_file (full_path, NULL);
 
-    cairo_set_source_rgba (cr, 0.0, 0.0, 0.0, .5);
-    cairo_rectangle (cr, rx, ry, rw, rh);
-    cairo_fill (cr);
+    g_free (filename);
+    g_free (full_path);
 
-    cairo_set_source_rgba (cr, 1.0, 1.0, 1.0, .8);
-    cairo_rectangle (cr, rx - 1, ry - 1, rw, rh);
-    cairo_fill (cr);
+    if (pixbuf == NULL)
+    {
+        _xapp_trace_span (XAPP_TRACE_FLAG_LOAD_TIME, trace_start);
+        return NULL;
+    }
 
-    cairo_set_source_rgba (cr, 0.0, 0.0, 0.0, 1.0);
+    surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                          gdk_pixbuf_get_width (pixbuf),
+                                          gdk_pixbuf_get_height (pixbuf));
 
-    gchar *num_string = g_strdup_printf ("%d", id);
-    cairo_select_font_face (cr, "sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
-    cairo_set_font_size (cr, height / 2);
+    cr = cairo_create (surface);
+    gdk_cairo_set_source_pixbuf (cr, pixbuf, 0, 0);
+    cairo_paint (cr);
+    cairo_destroy (cr);
 
-    cairo_text_extents_t ext;
-    cairo_text_extents (cr, num_string, &ext);
+    g_object_unref (pixbuf);
 
-    cairo_move_to (cr, rx + (rw / 2) - (ext.width / 2) - 1, ry + (rh / 2) + (ext.height / 2) - 1);
+    _xapp_trace_span (XAPP_TRACE_FLAG_LOAD_TIME, trace_start);
 
-    cairo_show_text (cr, num_string);
-    g_free (num_string);
+    return surface;
+}
 
-    GdkPixbuf *ret = gdk_pixbuf_get_from_surface (surface, 0, 0, width, height);
+static cairo_surface_t *
+add_notation (cairo_surface_t *original, gint id)
+{
+    gint width, height, src_stride, stride, row;
+    const guchar *src;
+    cairo_surface_t *surface;
+    guchar *pixels;
+    gint64 trace_start = _xapp_trace_span_begin ();
 
-    cairo_surface_destroy (surface);
-    cairo_destroy (cr);
+    width = cairo_image_surface_get_width (original);
+    height = cairo_image_surface_get_height (original);
 
-    if (ret == NULL)
+    surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+    
+    if (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS)
     {
+        cairo_surface_destroy (surface);
         return original;
     }
 
-    g_object_unref (original);
+    /* The original may be read-only atlas pixels, so copy them over before
+     * drawing the badge directly onto the copy.
+     */
+    cairo_surface_flush (original);
+    cairo_surface_flush (surface);
+
+    src = cairo_image_surface_get_data (original);
+    src_stride = cairo_image_surface_get_stride (original);
+    pixels = cairo_image_surface_get_data (surface);
+    stride = cairo_image_surface_get_stride (surface);
 
-    return ret;
+    for (row = 0; row < height; row++)
+    {
+        memcpy (pixels + row * stride, src + row * src_stride, width * 4);
+    }
+
+    _xapp_kbd_badge_composite (pixels, width, height, stride, id, 1);
+
+    cairo_surface_mark_dirty (surface);
+
+    cairo_surface_destroy (original);
+
+    _xapp_trace_span (XAPP_TRACE_NOTATION_TIME, trace_start);
+
+    return surface;
 }
 
-static gchar *
-create_pixbuf (XAppKbdLayoutController *controller,
-               guint                    group,
-               const gchar             *name,
-               gint                     id)
+/* Renders the flag (and badge) directly at the target resolution, fitted
+ * into a size x size logical square, rather than scaling the native image
+ * afterwards.  The returned surface has its device scale set to scale.
+ */
+static cairo_surface_t *
+create_sized_surface (const gchar *name,
+                      gint         id,
+                      gint         size,
+                      gint         scale)
 {
-    XAppKbdLayoutControllerPrivate *priv = controller->priv;
-    GdkPixbuf *pixbuf = NULL;
+    cairo_surface_t *flag, *surface;
+    cairo_pattern_t *pattern;
+    gint flag_width, flag_height, width, height;
+    cairo_t *cr;
 
-    GdkPixbuf *flag_pixbuf;
+    flag = load_flag_surface (name);
 
-    gchar *filename = g_strdup_printf ("%s.png", name);
-    gchar *full_path = g_build_filename (priv->flag_dir, filename, NULL);
+    if (flag == NULL)
+    {
+        return NULL;
+    }
 
-    flag_pixbuf = gdk_pixbuf_new_from_file (full_path, NULL);
+    flag_width = cairo_image_surface_get_width (flag);
+    flag_height = cairo_image_surface_get_height (flag);
 
-    g_free (filename);
-    g_free (full_path);
+    if (flag_width >= flag_height)
+    {
+        width = size * scale;
+        height = MAX (1, (gint) round ((gdouble) width * flag_height / flag_width));
+    }
+    else
+    {
+        height = size * scale;
+        width = MAX (1, (gint) round ((gdouble) height * flag_width / flag_height));
+    }
+
+    surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
 
-    if (flag_pixbuf != NULL)
+    if (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS)
     {
-        if (id == 0)
-        {
-            pixbuf = flag_pixbuf;
-        }
-        else
-        {
-            pixbuf = add_notation (flag_pixbuf, id);
-        }
+        cairo_surface_destroy (surface);
+        cairo_surface_destroy (flag);
+        return NULL;
     }
 
-    if (flag_pixbuf != NULL)
+    cr = cairo_create (surface);
+
+    cairo_scale (cr, (gdouble) width / flag_width, (gdouble) height / flag_height);
+    cairo_set_source_surface (cr, flag, 0, 0);
+
+    pattern = cairo_get_source (cr);
+    cairo_pattern_set_filter (pattern, CAIRO_FILTER_BEST);
+    cairo_pattern_set_extend (pattern, CAIRO_EXTEND_PAD);
+
+    cairo_paint (cr);
+
+    cairo_destroy (cr);
+    cairo_surface_destroy (flag);
+
+    if (id > 0)
     {
-        gchar *save_name = g_strdup_printf ("xapp-kbd-layout-%d.png", group);
+        gint64 trace_start = _xapp_trace_span_begin ();
 
-        gchar *path = g_build_filename (priv->temp_flag_theme_dir, save_name, NULL);
-        g_remove (path);
+        cairo_surface_flush (surface);
 
-        gdk_pixbuf_save (pixbuf,
-                         path,
-                         "png",
-                         NULL,
-                         NULL);
+        _xapp_kbd_badge_composite (cairo_image_surface_get_data (surface),
+                                   width, height,
+                                   cairo_image_surface_get_stride (surface),
+                                   id, scale);
 
-        g_object_unref (pixbuf);
+        cairo_surface_mark_dirty (surface);
 
-        g_free (save_name);
-        g_free (path);
+        _xapp_trace_span (XAPP_TRACE_NOTATION_TIME, trace_start);
     }
-    else
+
+    cairo_surface_set_device_scale (surface, scale, scale);
+
+    _xapp_trace_count (XAPP_TRACE_ICONS_RENDERED, 1);
+
+    return surface;
+}
+
+static GdkPixbuf *
+create_pixbuf (const gchar *name,
+               gint         id)
+{
+    cairo_surface_t *surface;
+    GdkPixbuf *pixbuf;
+
+    surface = load_flag_surface (name);
+
+    if (surface == NULL)
     {
         return NULL;
     }
 
-    return g_strdup_printf ("xapp-kbd-layout-%d", group);
+    if (id > 0)
+    {
+        surface = add_notation (surface, id);
+    }
+
+    pixbuf = gdk_pixbuf_get_from_surface (surface,
+                                          0, 0,
+                                          cairo_image_surface_get_width (surface),
+                                          cairo_image_surface_get_height (surface));
+
+    cairo_surface_destroy (surface);
+
+    _xapp_trace_count (XAPP_TRACE_ICONS_RENDERED, 1);
+
+    return pixbuf;
 }
 
-static void
-load_stores (XAppKbdLayoutController *controller)
+/* Asks the session service for its render of the flag, which may be
+ * NULL if there's no flag.  This blocks on the bus, so it only ever runs
+ * on worker threads.  Returns FALSE if the call failed, or if the names
+ * it returns show the service's groups changed since ours were mirrored -
+ * we'll be reloaded shortly then.
+ */
+static gboolean
+fetch_pixbuf (LayoutStore   *store,
+              guint          group,
+              GCancellable  *cancellable,
+              GdkPixbuf    **pixbuf)
 {
-    XAppKbdLayoutControllerPrivate *priv = controller->priv;
+    GroupData *data = g_ptr_array_index (store->groups, group);
+    GVariant *result, *image;
+    const gchar *name, *short_name;
+    gboolean ret = FALSE;
+
+    *pixbuf = NULL;
+
+    result = g_dbus_proxy_call_sync (store->proxy,
+                                     "GetIcon",
+                                     g_variant_new ("(u)", group),
+                                     G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                     GET_ICON_TIMEOUT,
+                                     cancellable,
+                                     NULL);
+
+    if (result == NULL)
+    {
+        return FALSE;
+    }
 
-    gchar **group_names = gkbd_configuration_get_group_names (priv->config);
-    priv->num_groups = g_strv_length (group_names);
+    g_variant_get (result, "(&s&s@(iiibiiay))", &name, &short_name, &image);
 
-    /* We do nothing if there's only one keyboard layout enabled */
-    if (priv->num_groups == 1)
+    if (g_strcmp0 (name, store->full_names[group]) == 0 &&
+        g_strcmp0 (short_name, data->text) == 0)
     {
-        priv->enabled = FALSE;
-        return;
+        *pixbuf = _xapp_kbd_layout_dbus_pixbuf_from_variant (image);
+        ret = TRUE;
     }
 
-    priv->enabled = TRUE;
+    g_variant_unref (image);
+    g_variant_unref (result);
 
-    /* Make a list of [name, id] tuples, where name is the group/flag name,
-     * and id is either 0, or, if a flag name is duplicated, a 1, 2, 3, etc...
-     */
-    gint i, j, id;
-    GPtrArray *list = g_ptr_array_new_with_free_func ((GDestroyNotify) group_data_free);
+    return ret;
+}
 
-    for (i = 0; i < priv->num_groups; i++)
-    {
-        GroupData *data = g_slice_new0 (GroupData);
+/* Fills in the flags of the groups nobody has rendered yet with the
+ * service's renders.  Worker threads only, see fetch_pixbuf().
+ */
+static void
+layout_store_fetch_pixbufs (LayoutStore  *store,
+                            GCancellable *cancellable)
+{
+    guint i;
 
-        gchar *name = gkbd_configuration_get_group_name (priv->config, i);
-        id = 0;
+    for (i = 0; i < store->groups->len; i++)
+    {
+        GroupData *data = g_ptr_array_index (store->groups, i);
+        GdkPixbuf *pixbuf;
 
-        for (j = 0; j < list->len; j++)
+        if (g_atomic_int_get (&data->pixbuf_tried))
         {
-            GroupData *iter = g_ptr_array_index (list, j);
+            continue;
+        }
 
-            if (g_strcmp0 (name, iter->group) == 0)
-            {
-                id++;
-                iter->id = id;
-            }
+        /* The service is gone, stuck or out of date - whatever's left is
+         * rendered locally when it's needed.
+         */
+        if (!fetch_pixbuf (store, i, cancellable, &pixbuf))
+        {
+            return;
         }
 
-        if (id > 0)
+        g_mutex_lock (&store->render_lock);
+
+        if (!data->pixbuf_tried)
         {
-            id++;
+            data->pixbuf = pixbuf;
+            pixbuf = NULL;
+
+            g_atomic_int_set (&data->pixbuf_tried, TRUE);
         }
 
-        data->group = name;
-        data->id = id;
+        g_mutex_unlock (&store->render_lock);
 
-        g_ptr_array_add (list, data);
+        g_clear_object (&pixbuf);
     }
+}
 
-    for (i = 0; i < list->len; i++)
-    {
-        GroupData *data = g_ptr_array_index (list, i);
+static void
+fetch_pixbufs_thread (GTask        *task,
+                      gpointer      source_object,
+                      gpointer      task_data,
+                      GCancellable *cancellable)
+{
+    layout_store_fetch_pixbufs (task_data, cancellable);
+
+    g_task_return_boolean (task, TRUE);
+}
 
-        priv->icon_names[i] = create_pixbuf (controller, i, data->group, data->id);
-        priv->text_store[i] = create_text (controller, data->group, data->id);
+/* Returns TRUE if the caller should fetch the flags from the service -
+ * only the first one to ask does.  Called with render_lock held.
+ */
+static gboolean
+layout_store_claim_fetch (LayoutStore *store)
+{
+    if (store->proxy == NULL || store->fetch_claimed)
+    {
+        return FALSE;
     }
 
-    gtk_icon_theme_rescan_if_needed (gtk_icon_theme_get_default ());
+    store->fetch_claimed = TRUE;
 
-    g_ptr_array_unref (list);
+    return TRUE;
 }
 
-static gboolean
-idle_config_changed (XAppKbdLayoutController *controller)
+static GdkPixbuf *
+layout_store_ensure_pixbuf (LayoutStore *store,
+                            guint        group)
 {
-    XAppKbdLayoutControllerPrivate *priv = controller->priv;
+    GroupData *data = g_ptr_array_index (store->groups, group);
 
-    clear_stores (controller);
-    load_stores (controller);
+    if (!g_atomic_int_get (&store->icons_used))
+    {
+        g_atomic_int_set (&store->icons_used, TRUE);
+    }
 
-    if (gkbd_configuration_get_current_group (priv->config) >= priv->num_groups)
+    /* Once tried, the pixbuf never changes again */
+    if (g_atomic_int_get (&data->pixbuf_tried))
     {
-        xapp_kbd_layout_controller_set_current_group (controller, 0);
+        return data->pixbuf;
     }
 
-    g_signal_emit (controller, signals[KBD_CONFIG_CHANGED], 0);
+    g_mutex_lock (&store->render_lock);
 
-    priv->idle_changed_id = 0;
-    return FALSE;
+    /* Whoever asks never waits on the bus: the flags the service has come
+     * in the background, and this one is rendered right away.
+     */
+    if (layout_store_claim_fetch (store))
+    {
+        GTask *task = g_task_new (NULL, NULL, NULL, NULL);
+
+        g_task_set_task_data (task, layout_store_ref (store), (GDestroyNotify) layout_store_unref);
+        g_task_run_in_thread (task, fetch_pixbufs_thread);
+        g_object_unref (task);
+    }
+
+    if (!data->pixbuf_tried)
+    {
+        data->pixbuf = create_pixbuf (data->group, data->id);
+
+        g_atomic_int_set (&data->pixbuf_tried, TRUE);
+    }
+
+    g_mutex_unlock (&store->render_lock);
+
+    return data->pixbuf;
 }
 
-static void
-on_configuration_changed (GkbdConfiguration       *config,
-                          XAppKbdLayoutController *controller)
+/* Cached icons are named after everything that affects their pixels, so
+ * they can be shared between processes and survive restarts.  A size of
+ * 0 means the flag's native size.
+ */
+static gchar *
+get_cached_icon_name (const gchar *name,
+                      gint         id,
+                      gint         size,
+                      gint         scale)
+{
+    gchar *key = g_strdup_printf ("%s:%d:%d:%d:%d", name, id, size, scale, ICON_CACHE_RENDERER_VERSION);
+    gchar *checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, key, -1);
+
+    gchar *icon_name = g_strconcat (ICON_CACHE_PREFIX, checksum, NULL);
+
+    g_free (checksum);
+    g_free (key);
+
+    return icon_name;
+}
+
+static gboolean
+write_cached_icon (GdkPixbuf   *pixbuf,
+                   const gchar *path)
+{
+    GError *error = NULL;
+    gchar *buffer;
+    gsize length;
+    gboolean ret;
+    gint64 trace_start = _xapp_trace_span_begin ();
+
+    if (!gdk_pixbuf_save_to_buffer (pixbuf, &buffer, &length, "png", &error, NULL))
+    {
+        g_warning ("Could not encode layout icon: %s", error->message);
+        g_error_free (error);
+        return FALSE;
+    }
+
+    _xapp_trace_span (XAPP_TRACE_ICON_ENCODE_TIME, trace_start);
+
+    /* This goes through a temporary file and a rename, so other processes
+     * sharing the cache never see a partially written icon.
+     */
+    ret = g_file_set_contents (path, buffer, length, &error);
+
+    if (!ret)
+    {
+        g_warning ("Could not save layout icon: %s", error->message);
+        g_error_free (error);
+    }
+    else
+    {
+        _xapp_trace_count (XAPP_TRACE_ICON_BYTES_WRITTEN, length);
+    }
+
+    g_free (buffer);
+
+    return ret;
+}
+
+typedef struct
+{
+    gchar *path;
+    goffset size;
+    time_t mtime;
+} CacheEntry;
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+    g_free (entry->path);
+    g_slice_free (CacheEntry, entry);
+}
+
+static gint
+compare_cache_entries (gconstpointer a,
+                       gconstpointer b)
+{
+    const CacheEntry *ea = *(const CacheEntry **) a;
+    const CacheEntry *eb = *(const CacheEntry **) b;
+
+    return (ea->mtime > eb->mtime) - (ea->mtime < eb->mtime);
+}
+
+/* Deletes the least recently used cached icons until the cache fits in
+ * ICON_CACHE_MAX_SIZE, leaving alone any that the store is currently using
+ * or that were used within ICON_CACHE_MIN_AGE.  Hits bump the mtime, so it
+ * tracks the last use rather than the creation.
+ */
+static void
+evict_icon_cache (LayoutStore *store,
+                  const gchar *cache_dir)
+{
+    GDir *dir;
+    const gchar *filename;
+    GPtrArray *entries;
+    GHashTable *in_use;
+    goffset total = 0;
+    time_t cutoff;
+    guint i;
+
+    dir = g_dir_open (cache_dir, 0, NULL);
+
+    if (dir == NULL)
+    {
+        return;
+    }
+
+    in_use = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    for (i = 0; i < store->groups->len; i++)
+    {
+        GroupData *data = g_ptr_array_index (store->groups, i);
+
+        if (data->icon_name != NULL)
+        {
+            g_hash_table_add (in_use, g_strconcat (data->icon_name, ".png", NULL));
+        }
+    }
+
+    entries = g_ptr_array_new_with_free_func ((GDestroyNotify) cache_entry_free);
+    cutoff = (time_t) (g_get_real_time () / G_USEC_PER_SEC) - ICON_CACHE_MIN_AGE;
+
+    while ((filename = g_dir_read_name (dir)) != NULL)
+    {
+        CacheEntry *entry;
+        GStatBuf buf;
+        gchar *path;
+
+        if (!g_str_has_prefix (filename, ICON_CACHE_PREFIX) || !g_str_has_suffix (filename, ".png"))
+        {
+            continue;
+        }
+
+        path = g_build_filename (cache_dir, filename, NULL);
+
+        if (g_stat (path, &buf) != 0)
+        {
+            g_free (path);
+            continue;
+        }
+
+        total += buf.st_size;
+
+        if (g_hash_table_contains (in_use, filename) || buf.st_mtime > cutoff)
+        {
+            g_free (path);
+            continue;
+        }
+
+        entry = g_slice_new0 (CacheEntry);
+        entry->path = path;
+        entry->size = buf.st_size;
+        entry->mtime = buf.st_mtime;
+
+        g_ptr_array_add (entries, entry);
+    }
+
+    g_dir_close (dir);
+
+    if (total > ICON_CACHE_MAX_SIZE)
+    {
+        g_ptr_array_sort (entries, compare_cache_entries);
+
+        for (i = 0; i < entries->len && total > ICON_CACHE_MAX_SIZE; i++)
+        {
+            CacheEntry *entry = g_ptr_array_index (entries, i);
+
+            if (g_remove (entry->path) == 0)
+            {
+                total -= entry->size;
+            }
+        }
+    }
+
+    g_ptr_array_unref (entries);
+    g_hash_table_unref (in_use);
+}
+
+/* Resolves the cached icon name of every group, rendering and writing
+ * any that are missing.  Returns TRUE if any name was newly resolved - the
+ * file may have been written by us or by another process since the icon
+ * theme last looked, so either way it needs a rescan (from the main thread).
+ */
+static gboolean
+layout_store_save_icon_names (LayoutStore *store,
+                              const gchar *cache_dir)
+{
+    gboolean wrote_any = FALSE;
+    gboolean resolved_any = FALSE;
+    gint i;
+
+    if (store->icon_names_saved)
+    {
+        return FALSE;
+    }
+
+    for (i = 0; i < store->groups->len; i++)
+    {
+        GroupData *data = g_ptr_array_index (store->groups, i);
+
+        /* Already saved for a previous configuration */
+        if (data->icon_name != NULL)
+        {
+            continue;
+        }
+
+        gchar *icon_name = get_cached_icon_name (data->group, data->id, 0, 1);
+        gchar *save_name = g_strconcat (icon_name, ".png", NULL);
+        gchar *path = g_build_filename (cache_dir, save_name, NULL);
+
+        /* On a hit this stat is all we pay - no decode, notation or encode */
+        if (!g_file_test (path, G_FILE_TEST_EXISTS))
+        {
+            GdkPixbuf *pixbuf = layout_store_ensure_pixbuf (store, i);
+
+            if (pixbuf == NULL || !write_cached_icon (pixbuf, path))
+            {
+                g_clear_pointer (&icon_name, g_free);
+            }
+            else
+            {
+                wrote_any = TRUE;
+            }
+        }
+        else
+        {
+            /* Keep the mtime as the last use, for evict_icon_cache() */
+            g_utime (path, NULL);
+
+            _xapp_trace_count (XAPP_TRACE_ICON_CACHE_HITS, 1);
+        }
+
+        g_free (save_name);
+        g_free (path);
+
+        if (icon_name != NULL)
+        {
+            resolved_any = TRUE;
+        }
+
+        data->icon_name = icon_name;
+    }
+
+    if (wrote_any)
+    {
+        evict_icon_cache (store, cache_dir);
+    }
+
+    store->icon_names_saved = TRUE;
+
+    return resolved_any;
+}
+
+/* Takes ownership of group_names and full_names.  If proxy is set,
+ * flags are fetched from the session service in the background, and
+ * rendered locally until they arrive.
+ */
+static LayoutStore *
+layout_store_new (gchar      **group_names,
+                  gchar      **full_names,
+                  GDBusProxy  *proxy)
+{
+    LayoutStore *store = g_slice_new0 (LayoutStore);
+
+    store->ref_count = 1;
+    store->num_groups = g_strv_length (group_names);
+    store->full_names = full_names;
+    store->proxy = proxy != NULL ? g_object_ref (proxy) : NULL;
+    g_mutex_init (&store->render_lock);
+
+    /* We do nothing if there's only one keyboard layout enabled (or none,
+     * from a service that's lost its configuration).
+     */
+    if (store->num_groups <= 1)
+    {
+        g_strfreev (group_names);
+        return store;
+    }
+
+    /* Make a list of [name, id] tuples, where name is the group/flag name,
+     * and id is either 0, or, if a flag name is duplicated, a 1, 2, 3, etc...
+     *
+     * last_seen maps each name to the latest group using it, so numbering
+     * duplicates stays a single pass however many groups there are.
+     */
+    gint i;
+    GPtrArray *list = g_ptr_array_new_full (store->num_groups, (GDestroyNotify) group_data_free);
+    GHashTable *last_seen = g_hash_table_new (g_str_hash, g_str_equal);
+
+    for (i = 0; i < store->num_groups; i++)
+    {
+        GroupData *data = g_slice_new0 (GroupData);
+        GroupData *previous;
+
+        data->group = group_names[i];
+
+        previous = g_hash_table_lookup (last_seen, data->group);
+
+        if (previous != NULL)
+        {
+            if (previous->id == 0)
+            {
+                previous->id = 1;
+            }
+
+            data->id = previous->id + 1;
+        }
+
+        g_hash_table_insert (last_seen, data->group, data);
+        g_ptr_array_add (list, data);
+    }
+
+    g_hash_table_unref (last_seen);
+
+    /* The strings now belong to the GroupData */
+    g_free (group_names);
+
+    for (i = 0; i < list->len; i++)
+    {
+        GroupData *data = g_ptr_array_index (list, i);
+
+        data->text = create_text (data->group, data->id);
+    }
+
+    /* Flags are only rendered when an icon or icon name is asked for */
+    store->groups = list;
+
+    return store;
+}
+
+static guint
+layout_store_get_n_items (LayoutStore *store)
+{
+    if (store == NULL || store->groups == NULL)
+    {
+        return 0;
+    }
+
+    return store->groups->len;
+}
+
+/* Whether a group looks exactly the same in both stores - same name,
+ * same flag and same duplicate number.
+ */
+static gboolean
+layout_store_group_equal (LayoutStore *a,
+                          LayoutStore *b,
+                          guint        group)
+{
+    GroupData *data_a, *data_b;
+
+    if (group >= layout_store_get_n_items (a) || group >= layout_store_get_n_items (b))
+    {
+        return FALSE;
+    }
+
+    data_a = g_ptr_array_index (a->groups, group);
+    data_b = g_ptr_array_index (b->groups, group);
+
+    return data_a->id == data_b->id &&
+           g_strcmp0 (data_a->group, data_b->group) == 0 &&
+           g_strcmp0 (a->full_names[group], b->full_names[group]) == 0;
+}
+
+static gboolean
+strv_equal (gchar **a,
+            gchar **b)
+{
+    gint i;
+
+    for (i = 0; a[i] != NULL && b[i] != NULL; i++)
+    {
+        if (g_strcmp0 (a[i], b[i]) != 0)
+        {
+            return FALSE;
+        }
+    }
+
+    return a[i] == b[i];
+}
+
+/* Appends the index of every group that differs between old_store and
+ * new_store (including ones that only exist in one of them) to changed.
+ * Returns FALSE if nothing at all changed - changed can be empty even
+ * when this returns TRUE, if only the name of a single layout changed.
+ */
+static gboolean
+layout_store_diff (LayoutStore *old_store,
+                   LayoutStore *new_store,
+                   GArray      *changed)
+{
+    guint i, n;
+
+    n = layout_store_get_n_items (new_store);
+
+    if (old_store == NULL)
+    {
+        for (i = 0; i < n; i++)
+        {
+            g_array_append_val (changed, i);
+        }
+
+        return TRUE;
+    }
+
+    n = MAX (n, layout_store_get_n_items (old_store));
+
+    for (i = 0; i < n; i++)
+    {
+        if (!layout_store_group_equal (old_store, new_store, i))
+        {
+            g_array_append_val (changed, i);
+        }
+    }
+
+    if (changed->len > 0)
+    {
+        return TRUE;
+    }
+
+    return old_store->num_groups != new_store->num_groups ||
+           !strv_equal (old_store->full_names, new_store->full_names);
+}
+
+/* Hands whatever old_store already rendered or saved over to store, so
+ * only flags that are new (or whose duplicate number changed) get
+ * rendered and written again.  Groups are matched by flag and number,
+ * not position, so reordering layouts costs nothing.
+ */
+static void
+layout_store_adopt_renders (LayoutStore *store,
+                            LayoutStore *old_store)
+{
+    GHashTable *rendered;
+    guint i;
+
+    if (layout_store_get_n_items (store) == 0 || layout_store_get_n_items (old_store) == 0)
+    {
+        return;
+    }
+
+    store->icons_used = old_store->icons_used;
+
+    /* Other threads may still be rendering into the old store */
+    g_mutex_lock (&old_store->render_lock);
+
+    rendered = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    for (i = 0; i < old_store->groups->len; i++)
+    {
+        GroupData *data = g_ptr_array_index (old_store->groups, i);
+
+        g_hash_table_insert (rendered, g_strdup_printf ("%s:%d", data->group, data->id), data);
+    }
+
+    for (i = 0; i < store->groups->len; i++)
+    {
+        GroupData *data = g_ptr_array_index (store->groups, i);
+        GroupData *old_data;
+        gchar *key;
+
+        key = g_strdup_printf ("%s:%d", data->group, data->id);
+        old_data = g_hash_table_lookup (rendered, key);
+        g_free (key);
+
+        if (old_data == NULL)
+        {
+            continue;
+        }
+
+        data->pixbuf = old_data->pixbuf != NULL ? g_object_ref (old_data->pixbuf) : NULL;
+        data->pixbuf_tried = old_data->pixbuf_tried;
+        data->icon_name = g_strdup (old_data->icon_name);
+    }
+
+    g_mutex_unlock (&old_store->render_lock);
+
+    g_hash_table_unref (rendered);
+}
+
+static gchar **
+get_proxy_strv (GDBusProxy  *proxy,
+                const gchar *property)
+{
+    GVariant *value = g_dbus_proxy_get_cached_property (proxy, property);
+    gchar **strv;
+
+    if (value == NULL)
+    {
+        return g_new0 (gchar *, 1);
+    }
+
+    strv = g_variant_dup_strv (value, NULL);
+    g_variant_unref (value);
+
+    return strv;
+}
+
+static gchar **
+get_group_names (LayoutBackend *backend)
+{
+    gchar **names;
+    gint i, n;
+
+    if (backend->proxy != NULL)
+    {
+        return get_proxy_strv (backend->proxy, "GroupNames");
+    }
+
+    n = g_strv_length (gkbd_configuration_get_group_names (backend->config));
+    names = g_new0 (gchar *, n + 1);
+
+    for (i = 0; i < n; i++)
+    {
+        names[i] = gkbd_configuration_get_group_name (backend->config, i);
+    }
+
+    return names;
+}
+
+static gchar **
+get_full_group_names (LayoutBackend *backend)
+{
+    if (backend->proxy != NULL)
+    {
+        return get_proxy_strv (backend->proxy, "FullNames");
+    }
+
+    return g_strdupv (gkbd_configuration_get_group_names (backend->config));
+}
+
+static guint
+get_backend_current_group (LayoutBackend *backend)
+{
+    if (backend->proxy != NULL)
+    {
+        GVariant *value = g_dbus_proxy_get_cached_property (backend->proxy, "CurrentGroup");
+        guint group = 0;
+
+        if (value != NULL)
+        {
+            group = g_variant_get_uint32 (value);
+            g_variant_unref (value);
+        }
+
+        return group;
+    }
+
+    return gkbd_configuration_get_current_group (backend->config);
+}
+
+/* Locks the group straight through XKB, rather than through gkbd */
+static gboolean
+xkb_lock_group (guint group)
+{
+    GdkDisplay *display = gdk_display_get_default ();
+    Display *xdisplay;
+
+    if (display == NULL || !GDK_IS_X11_DISPLAY (display))
+    {
+        return FALSE;
+    }
+
+    xdisplay = GDK_DISPLAY_XDISPLAY (display);
+
+    if (!XkbLockGroup (xdisplay, XkbUseCoreKbd, group))
+    {
+        return FALSE;
+    }
+
+    XFlush (xdisplay);
+
+    return TRUE;
+}
+
+static LayoutBackend *layout_backend_ref   (LayoutBackend *backend);
+static void           layout_backend_unref (LayoutBackend *backend);
+
+static void
+end_switch (LayoutBackend *backend)
+{
+    backend->switch_requested = 0;
+
+    if (backend->switch_timeout_id != 0)
+    {
+        g_source_remove (backend->switch_timeout_id);
+        backend->switch_timeout_id = 0;
+    }
+}
+
+static gboolean
+switch_timeout (gpointer data)
+{
+    LayoutBackend *backend = data;
+
+    backend->switch_timeout_id = 0;
+    end_switch (backend);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+begin_switch (LayoutBackend *backend,
+              guint          group)
+{
+    end_switch (backend);
+
+    backend->requested_group = group;
+    backend->switch_requested = g_get_monotonic_time ();
+    backend->switch_timeout_id = g_timeout_add (SWITCH_TIMEOUT, switch_timeout, backend);
+}
+
+typedef struct
+{
+    LayoutBackend *backend;
+    gint64 switch_requested;
+} SwitchCallData;
+
+static void
+set_current_group_finished (GObject      *source,
+                            GAsyncResult *result,
+                            gpointer      user_data)
+{
+    SwitchCallData *data = user_data;
+    GVariant *ret;
+    GError *error = NULL;
+
+    ret = g_dbus_proxy_call_finish (G_DBUS_PROXY (source), result, &error);
+
+    if (ret != NULL)
+    {
+        g_variant_unref (ret);
+    }
+    else
+    {
+        g_warning ("Could not switch the layout group: %s", error->message);
+        g_error_free (error);
+
+        /* Nothing is coming back - unless a newer switch replaced this one */
+        if (data->backend->switch_requested == data->switch_requested)
+        {
+            end_switch (data->backend);
+        }
+    }
+
+    layout_backend_unref (data->backend);
+    g_slice_free (SwitchCallData, data);
+}
+
+/* The group switches are relative to - the one we're already on the way
+ * to, if an earlier switch hasn't come back yet.
+ */
+static guint
+get_switch_base (LayoutBackend *backend)
+{
+    return backend->switch_requested != 0 ? backend->requested_group : backend->current_group;
+}
+
+static void
+lock_group (LayoutBackend *backend,
+            guint          group)
+{
+    begin_switch (backend, group);
+
+    if (backend->proxy != NULL)
+    {
+        SwitchCallData *data = g_slice_new (SwitchCallData);
+
+        data->backend = layout_backend_ref (backend);
+        data->switch_requested = backend->switch_requested;
+
+        /* Comes back as LayoutChanged, like group-changed does locally */
+        g_dbus_proxy_call (backend->proxy,
+                           "SetCurrentGroup",
+                           g_variant_new ("(u)", group),
+                           G_DBUS_CALL_FLAGS_NONE,
+                           -1, NULL,
+                           set_current_group_finished,
+                           data);
+        return;
+    }
+
+    if (!xkb_lock_group (group))
+    {
+        gkbd_configuration_lock_group (backend->config, group);
+    }
+}
+
+static GroupData *
+get_group_data (LayoutBackend *backend,
+                guint          group)
+{
+    return g_ptr_array_index (backend->store->groups, group);
+}
+
+static GdkPixbuf *
+ensure_pixbuf (LayoutBackend *backend,
+               guint          group)
+{
+    return layout_store_ensure_pixbuf (backend->store, group);
+}
+
+static void
+rescan_icon_theme (void)
+{
+    gint64 trace_start = _xapp_trace_span_begin ();
+
+    gtk_icon_theme_rescan_if_needed (gtk_icon_theme_get_default ());
+
+    _xapp_trace_span (XAPP_TRACE_ICON_THEME_RESCAN_TIME, trace_start);
+}
+
+static void
+save_icon_names (LayoutBackend *backend)
+{
+    initialize_icon_theme (backend);
+
+    if (layout_store_save_icon_names (backend->store, backend->temp_flag_theme_dir))
+    {
+        rescan_icon_theme ();
+    }
+}
+
+typedef struct
+{
+    guint group;
+    guint size;
+    guint scale;
+    cairo_surface_t *surface;
+} SurfaceCacheEntry;
+
+static void
+surface_cache_entry_free (SurfaceCacheEntry *entry)
+{
+    cairo_surface_destroy (entry->surface);
+    g_slice_free (SurfaceCacheEntry, entry);
+}
+
+static void
+clear_surface_cache (LayoutBackend *backend)
+{
+    SurfaceCacheEntry *entry;
+
+    while ((entry = g_queue_pop_head (backend->surface_cache)) != NULL)
+    {
+        surface_cache_entry_free (entry);
+    }
+}
+
+/* Drops the renders of the groups in changed, the rest are still valid */
+static void
+prune_surface_cache (LayoutBackend *backend,
+                     GArray        *changed)
+{
+    GList *l, *next;
+    guint i;
+
+    for (l = backend->surface_cache->head; l != NULL; l = next)
+    {
+        SurfaceCacheEntry *entry = l->data;
+
+        next = l->next;
+
+        for (i = 0; i < changed->len; i++)
+        {
+            if (g_array_index (changed, guint, i) == entry->group)
+            {
+                surface_cache_entry_free (entry);
+                g_queue_delete_link (backend->surface_cache, l);
+                break;
+            }
+        }
+    }
+}
+
+/* A small LRU of sized renders - the head is the most recently used.
+ * Consumers only ever display a handful of sizes, so a linear scan is
+ * cheaper than hashing here.
+ */
+static cairo_surface_t *
+lookup_sized_surface (LayoutBackend *backend,
+                      guint          group,
+                      guint          size,
+                      guint          scale)
+{
+    SurfaceCacheEntry *entry;
+    GList *l;
+
+    for (l = backend->surface_cache->head; l != NULL; l = l->next)
+    {
+        entry = l->data;
+
+        if (entry->group == group && entry->size == size && entry->scale == scale)
+        {
+            g_queue_unlink (backend->surface_cache, l);
+            g_queue_push_head_link (backend->surface_cache, l);
+
+            _xapp_trace_count (XAPP_TRACE_SURFACE_CACHE_HITS, 1);
+
+            return entry->surface;
+        }
+    }
+
+    GroupData *data = get_group_data (backend, group);
+    cairo_surface_t *surface;
+
+    surface = create_sized_surface (data->group, data->id, size, scale);
+
+    if (surface == NULL)
+    {
+        return NULL;
+    }
+
+    entry = g_slice_new0 (SurfaceCacheEntry);
+    entry->group = group;
+    entry->size = size;
+    entry->scale = scale;
+    entry->surface = surface;
+
+    g_queue_push_head (backend->surface_cache, entry);
+
+    while (g_queue_get_length (backend->surface_cache) > SURFACE_CACHE_MAX_ENTRIES)
+    {
+        surface_cache_entry_free (g_queue_pop_tail (backend->surface_cache));
+    }
+
+    return surface;
+}
+
+static gboolean
+free_retired_states (gpointer data)
+{
+    LayoutBackend *backend = data;
+
+    if (g_atomic_int_get (&backend->readers) > 0)
+    {
+        return G_SOURCE_CONTINUE;
+    }
+
+    g_slist_free_full (backend->retired, (GDestroyNotify) xapp_kbd_layout_state_unref);
+    backend->retired = NULL;
+    backend->retire_id = 0;
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Replaces the published snapshot with one of the current store and group */
+static void
+publish_state (LayoutBackend *backend)
+{
+    XAppKbdLayoutState *state, *old;
+
+    state = g_slice_new0 (XAppKbdLayoutState);
+    state->ref_count = 1;
+    state->store = layout_store_ref (backend->store);
+    state->current_group = backend->current_group;
+
+    old = g_atomic_pointer_get (&backend->state);
+    g_atomic_pointer_set (&backend->state, state);
+
+    if (old == NULL)
+    {
+        return;
+    }
+
+    backend->retired = g_slist_prepend (backend->retired, old);
+
+    if (backend->retire_id == 0 && free_retired_states (backend) == G_SOURCE_CONTINUE)
+    {
+        backend->retire_id = g_timeout_add (RETIRE_RETRY_INTERVAL, free_retired_states, backend);
+    }
+}
+
+/* Takes ownership of store and changed, the indices of the groups that
+ * differ from the current store.
+ */
+static void
+set_store (LayoutBackend *backend,
+           LayoutStore   *store,
+           GArray        *changed)
+{
+    prune_surface_cache (backend, changed);
+    g_clear_pointer (&backend->store, layout_store_unref);
+    g_clear_pointer (&backend->changed_groups, g_array_unref);
+
+    backend->store = store;
+    backend->changed_groups = changed;
+    backend->num_groups = store->num_groups;
+    backend->enabled = store->num_groups > 1;
+
+    publish_state (backend);
+
+    if (store->new_icon_names)
+    {
+        rescan_icon_theme ();
+    }
+}
+
+/* A referenced copy of the controllers list, so signal handlers can
+ * drop controllers while we go through them.
+ */
+static GList *
+get_controllers (LayoutBackend *backend)
+{
+    return g_list_copy_deep (backend->controllers, (GCopyFunc) g_object_ref, NULL);
+}
+
+static XAppKbdLayoutItem *
+create_item (XAppKbdLayoutController *controller,
+             guint                    group)
+{
+    LayoutBackend *backend = controller->priv->backend;
+
+    return _xapp_kbd_layout_item_new (group,
+                                      backend->store->full_names[group],
+                                      get_group_data (backend, group)->text,
+                                      backend->state,
+                                      group == backend->current_group);
+}
+
+/* Replaces n_removed items at position with n_added new ones */
+static void
+replace_items (XAppKbdLayoutController *controller,
+               guint                    position,
+               guint                    n_removed,
+               guint                    n_added)
+{
+    XAppKbdLayoutControllerPrivate *priv = controller->priv;
+    gpointer *items;
+    guint i;
+
+    items = g_new (gpointer, n_added);
+
+    for (i = 0; i < n_added; i++)
+    {
+        items[i] = create_item (controller, position + i);
+    }
+
+    g_list_store_splice (priv->model, position, n_removed, items, n_added);
+
+    for (i = 0; i < n_added; i++)
+    {
+        g_object_unref (items[i]);
+    }
+
+    g_free (items);
+}
+
+/* Brings the model in line with the current store.  Only runs of groups
+ * that actually differ from the ones the model was built from are
+ * replaced, so bound views only redo those rows.
+ */
+static void
+sync_model (XAppKbdLayoutController *controller)
+{
+    XAppKbdLayoutControllerPrivate *priv = controller->priv;
+    LayoutStore *store = priv->backend->store;
+    guint n_old, n_new, n_common, i, run_start;
+
+    if (priv->model == NULL || priv->model_store == store)
+    {
+        return;
+    }
+
+    n_old = g_list_model_get_n_items (G_LIST_MODEL (priv->model));
+    n_new = layout_store_get_n_items (store);
+    n_common = MIN (n_old, n_new);
+
+    i = 0;
+
+    while (i < n_common)
+    {
+        if (layout_store_group_equal (priv->model_store, store, i))
+        {
+            XAppKbdLayoutItem *item = g_list_model_get_item (G_LIST_MODEL (priv->model), i);
+
+            /* Unchanged, but it shouldn't keep the old store alive */
+            _xapp_kbd_layout_item_set_state (item, priv->backend->state);
+            g_object_unref (item);
+
+            i++;
+            continue;
+        }
+
+        run_start = i;
+
+        while (i < n_common && !layout_store_group_equal (priv->model_store, store, i))
+        {
+            i++;
+        }
+
+        replace_items (controller, run_start, i - run_start, i - run_start);
+    }
+
+    if (n_new > n_old)
+    {
+        replace_items (controller, n_old, 0, n_new - n_old);
+    }
+    else if (n_old > n_new)
+    {
+        g_list_store_splice (priv->model, n_new, n_old - n_new, NULL, 0);
+    }
+
+    g_clear_pointer (&priv->model_store, layout_store_unref);
+    priv->model_store = layout_store_ref (store);
+}
+
+static void
+sync_model_active (XAppKbdLayoutController *controller)
+{
+    XAppKbdLayoutControllerPrivate *priv = controller->priv;
+    guint i, n;
+
+    if (priv->model == NULL)
+    {
+        return;
+    }
+
+    n = g_list_model_get_n_items (G_LIST_MODEL (priv->model));
+
+    for (i = 0; i < n; i++)
+    {
+        XAppKbdLayoutItem *item = g_list_model_get_item (G_LIST_MODEL (priv->model), i);
+
+        _xapp_kbd_layout_item_set_active (item, i == priv->backend->current_group);
+
+        g_object_unref (item);
+    }
+}
+
+typedef struct
+{
+    LayoutStore *store;
+    GArray *changed;
+    gchar *cache_dir;
+    gboolean render_icons;
+    gint64 trace_start;
+} ReloadData;
+
+static void
+reload_data_free (ReloadData *data)
+{
+    layout_store_unref (data->store);
+    g_array_unref (data->changed);
+    g_free (data->cache_dir);
+
+    g_slice_free (ReloadData, data);
+}
+
+/* Runs on a worker thread - only touches the ReloadData and the new store */
+static void
+reload_thread (GTask        *task,
+               gpointer      source_object,
+               gpointer      task_data,
+               GCancellable *cancellable)
+{
+    ReloadData *data = task_data;
+    LayoutStore *store = data->store;
+    gint i;
+
+    /* Warm up whatever consumers were using from the old store, so the
+     * new one is complete by the time it's swapped in.  Groups adopted
+     * from the old store are already done, so this only renders and
+     * writes the ones that changed.  With a service, its renders are
+     * fetched first - this is a worker, so it can wait on the bus.
+     */
+    if (store->groups != NULL)
+    {
+        if (data->render_icons)
+        {
+            gboolean claimed;
+
+            g_mutex_lock (&store->render_lock);
+            claimed = layout_store_claim_fetch (store);
+            g_mutex_unlock (&store->render_lock);
+
+            if (claimed)
+            {
+                layout_store_fetch_pixbufs (store, cancellable);
+            }
+
+            for (i = 0; i < store->groups->len; i++)
+            {
+                layout_store_ensure_pixbuf (store, i);
+            }
+        }
+
+        if (data->cache_dir != NULL)
+        {
+            store->new_icon_names = layout_store_save_icon_names (store, data->cache_dir);
+        }
+    }
+
+    if (g_task_return_error_if_cancelled (task))
+    {
+        return;
+    }
+
+    g_task_return_pointer (task, layout_store_ref (store), (GDestroyNotify) layout_store_unref);
+}
+
+static void
+update_current_group (LayoutBackend *backend,
+                      guint          group)
+{
+    GList *controllers, *l;
+
+    if (backend->current_group == group)
+    {
+        return;
+    }
+
+    backend->current_group = group;
+
+    publish_state (backend);
+
+    controllers = get_controllers (backend);
+
+    for (l = controllers; l != NULL; l = l->next)
+    {
+        sync_model_active (l->data);
+
+        g_object_notify (G_OBJECT (l->data), "current-group");
+    }
+
+    g_list_free_full (controllers, g_object_unref);
+}
+
+static void
+reload_finished (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+    LayoutBackend *backend = user_data;
+    ReloadData *data = g_task_get_task_data (G_TASK (result));
+    LayoutStore *store;
+    GList *controllers, *l;
+
+    store = g_task_propagate_pointer (G_TASK (result), NULL);
+
+    /* Cancelled - either superseded by a newer reload, or torn down */
+    if (store == NULL)
+    {
+        layout_backend_unref (backend);
+        return;
+    }
+
+    g_clear_object (&backend->reload_cancellable);
+
+    set_store (backend, store, g_array_ref (data->changed));
+
+    /* Whatever we were switching to was a group of the old layouts */
+    end_switch (backend);
+
+    _xapp_trace_count (XAPP_TRACE_RELOADS, 1);
+    _xapp_trace_span (XAPP_TRACE_RELOAD_TIME, data->trace_start);
+
+    controllers = get_controllers (backend);
+
+    for (l = controllers; l != NULL; l = l->next)
+    {
+        sync_model (l->data);
+    }
+
+    /* group-changed keeps current_group up to date, but resync in case
+     * the change reset it without one.
+     */
+    update_current_group (backend, get_backend_current_group (backend));
+
+    if (backend->enabled && backend->current_group >= backend->num_groups)
+    {
+        lock_group (backend, 0);
+    }
+
+    for (l = controllers; l != NULL; l = l->next)
+    {
+        g_signal_emit (l->data, signals[KBD_CONFIG_CHANGED], 0);
+    }
+
+    g_list_free_full (controllers, g_object_unref);
+
+    layout_backend_unref (backend);
+}
+
+static gboolean
+idle_config_changed (LayoutBackend *backend)
+{
+    ReloadData *data;
+    LayoutStore *store;
+    GArray *changed;
+    GTask *task;
+
+    backend->idle_changed_id = 0;
+
+    /* The service went away before we got here - keep what we have */
+    if (backend->proxy != NULL)
+    {
+        gchar *owner = g_dbus_proxy_get_name_owner (backend->proxy);
+
+        if (owner == NULL)
+        {
+            return FALSE;
+        }
+
+        g_free (owner);
+    }
+
+    if (backend->reload_cancellable != NULL)
+    {
+        g_cancellable_cancel (backend->reload_cancellable);
+        g_clear_object (&backend->reload_cancellable);
+    }
+
+    store = layout_store_new (get_group_names (backend),
+                              get_full_group_names (backend),
+                              backend->proxy);
+
+    changed = g_array_new (FALSE, FALSE, sizeof (guint));
+
+    /* Option changes come through here too - if the groups are exactly
+     * the ones we already have, there's nothing to reload or announce.
+     */
+    if (!layout_store_diff (backend->store, store, changed))
+    {
+        layout_store_unref (store);
+        g_array_unref (changed);
+        return FALSE;
+    }
+
+    layout_store_adopt_renders (store, backend->store);
+
+    data = g_slice_new0 (ReloadData);
+    data->store = store;
+    data->changed = changed;
+    data->cache_dir = backend->icon_theme_initialized ? g_strdup (backend->temp_flag_theme_dir) : NULL;
+    data->render_icons = backend->store != NULL && backend->store->icons_used;
+    data->trace_start = _xapp_trace_span_begin ();
+
+    backend->reload_cancellable = g_cancellable_new ();
+
+    /* The current store stays in place, untouched, until the new one is
+     * complete.  The task keeps the backend alive until it's done.
+     */
+    task = g_task_new (NULL, backend->reload_cancellable, reload_finished, layout_backend_ref (backend));
+    g_task_set_task_data (task, data, (GDestroyNotify) reload_data_free);
+    g_task_run_in_thread (task, reload_thread);
+    g_object_unref (task);
+
+    return FALSE;
+}
+
+static void
+queue_reload (LayoutBackend *backend)
+{
+    if (backend->idle_changed_id != 0)
+    {
+        g_source_remove (backend->idle_changed_id);
+        backend->idle_changed_id = 0;
+    }
+
+    backend->idle_changed_id = g_idle_add ((GSourceFunc) idle_config_changed, backend);
+}
+
+/* Emits the group the held back switches ended on, if it isn't the one
+ * last emitted.  Returns TRUE if anything was emitted.
+ */
+static gboolean
+flush_coalesced (XAppKbdLayoutController *controller)
+{
+    XAppKbdLayoutControllerPrivate *priv = controller->priv;
+    guint group = priv->backend->current_group;
+
+    if (!priv->coalesce_pending)
+    {
+        return FALSE;
+    }
+
+    priv->coalesce_pending = FALSE;
+
+    if (group == priv->emitted_group)
+    {
+        return FALSE;
+    }
+
+    priv->emitted_group = group;
+    g_signal_emit (controller, signals[KBD_LAYOUT_CHANGED], 0, group);
+
+    return TRUE;
+}
+
+static gboolean
+coalesce_timeout (XAppKbdLayoutController *controller)
+{
+    /* Keep throttling for as long as switches keep coming */
+    if (flush_coalesced (controller))
+    {
+        return G_SOURCE_CONTINUE;
+    }
+
+    controller->priv->coalesce_id = 0;
+
+    return G_SOURCE_REMOVE;
+}
+
+/* The first switch is emitted right away, and then at most one more per
+ * interval - carrying the group the switches in between ended on.
+ */
+static void
+emit_layout_changed (XAppKbdLayoutController *controller,
+                     guint                    group)
+{
+    XAppKbdLayoutControllerPrivate *priv = controller->priv;
+
+    if (priv->coalesce_interval == 0)
+    {
+        g_signal_emit (controller, signals[KBD_LAYOUT_CHANGED], 0, group);
+        return;
+    }
+
+    if (priv->coalesce_id != 0)
+    {
+        priv->coalesce_pending = TRUE;
+        return;
+    }
+
+    priv->emitted_group = group;
+    priv->coalesce_id = g_timeout_add (priv->coalesce_interval, (GSourceFunc) coalesce_timeout, controller);
+
+    g_signal_emit (controller, signals[KBD_LAYOUT_CHANGED], 0, group);
+}
+
+static void
+group_changed (LayoutBackend *backend,
+               guint          group)
+{
+    GList *controllers, *l;
+
+    /* Only our own switch counts - not one someone else made meanwhile,
+     * or an earlier one of ours we've since superseded.
+     */
+    if (backend->switch_requested != 0 && group == backend->requested_group)
+    {
+        backend->switch_latency = g_get_monotonic_time () - backend->switch_requested;
+        end_switch (backend);
+
+        _xapp_trace_count (XAPP_TRACE_GROUP_SWITCHES, 1);
+        _xapp_trace_count (XAPP_TRACE_SWITCH_LATENCY_TIME, backend->switch_latency);
+    }
+
+    update_current_group (backend, group);
+
+    controllers = get_controllers (backend);
+
+    for (l = controllers; l != NULL; l = l->next)
+    {
+        emit_layout_changed (l->data, group);
+    }
+
+    g_list_free_full (controllers, g_object_unref);
+}
+
+static void
+on_configuration_changed (GkbdConfiguration *config,
+                          LayoutBackend     *backend)
+{
+    queue_reload (backend);
+}
+
+
+static void
+on_configuration_group_changed (GkbdConfiguration *config,
+                                gint               group,
+                                LayoutBackend     *backend)
+{
+    group_changed (backend, (guint) group);
+}
+
+static void
+on_proxy_signal (GDBusProxy    *proxy,
+                 const gchar   *sender_name,
+                 const gchar   *signal_name,
+                 GVariant      *parameters,
+                 LayoutBackend *backend)
+{
+    if (g_strcmp0 (signal_name, "LayoutChanged") == 0)
+    {
+        guint group;
+
+        g_variant_get (parameters, "(u)", &group);
+
+        group_changed (backend, group);
+    }
+}
+
+static void
+on_proxy_properties_changed (GDBusProxy    *proxy,
+                             GVariant      *changed_properties,
+                             GStrv          invalidated_properties,
+                             LayoutBackend *backend)
+{
+    GVariantDict dict;
+
+    g_variant_dict_init (&dict, changed_properties);
+
+    if (g_variant_dict_contains (&dict, "GroupNames") || g_variant_dict_contains (&dict, "FullNames"))
+    {
+        queue_reload (backend);
+    }
+
+    g_variant_dict_clear (&dict);
+}
+
+/* If the service goes away we keep what we have - the next call to it
+ * starts it again, and we pick up its state once it's back.
+ */
+static void
+on_proxy_name_owner_changed (GDBusProxy    *proxy,
+                             GParamSpec    *pspec,
+                             LayoutBackend *backend)
+{
+    gchar *owner = g_dbus_proxy_get_name_owner (proxy);
+
+    if (owner != NULL)
+    {
+        queue_reload (backend);
+        g_free (owner);
+    }
+}
+
+/* Takes ownership of proxy - NULL to listen to gkbd ourselves */
+static LayoutBackend *
+layout_backend_new (GDBusProxy *proxy)
+{
+    LayoutBackend *backend = g_slice_new0 (LayoutBackend);
+    LayoutStore *store;
+    GArray *changed;
+
+    backend->ref_count = 1;
+    backend->surface_cache = g_queue_new ();
+    backend->switch_latency = -1;
+
+    backend->proxy = proxy;
+
+    if (backend->proxy != NULL)
+    {
+        g_signal_connect (backend->proxy,
+                          "g-signal",
+                          G_CALLBACK (on_proxy_signal),
+                          backend);
+
+        g_signal_connect (backend->proxy,
+                          "g-properties-changed",
+                          G_CALLBACK (on_proxy_properties_changed),
+                          backend);
+
+        g_signal_connect (backend->proxy,
+                          "notify::g-name-owner",
+                          G_CALLBACK (on_proxy_name_owner_changed),
+                          backend);
+    }
+    else
+    {
+        backend->config = gkbd_configuration_get ();
+
+        gkbd_configuration_start_listen (backend->config);
+
+        g_signal_connect (backend->config,
+                          "changed",
+                          G_CALLBACK (on_configuration_changed),
+                          backend);
+
+        g_signal_connect (backend->config,
+                          "group-changed",
+                          G_CALLBACK (on_configuration_group_changed),
+                          backend);
+    }
+
+    store = layout_store_new (get_group_names (backend),
+                              get_full_group_names (backend),
+                              backend->proxy);
+    changed = g_array_new (FALSE, FALSE, sizeof (guint));
+
+    backend->current_group = get_backend_current_group (backend);
+
+    layout_store_diff (NULL, store, changed);
+    set_store (backend, store, changed);
+
+    return backend;
+}
+
+static LayoutBackend *
+layout_backend_ref (LayoutBackend *backend)
+{
+    backend->ref_count++;
+
+    return backend;
+}
+
+static void
+layout_backend_unref (LayoutBackend *backend)
+{
+    if (--backend->ref_count > 0)
+    {
+        return;
+    }
+
+    if (default_backend == backend)
+    {
+        default_backend = NULL;
+    }
+
+    if (backend->config != NULL)
+    {
+        g_signal_handlers_disconnect_by_data (backend->config, backend);
+        gkbd_configuration_stop_listen (backend->config);
+        g_clear_object (&backend->config);
+    }
+
+    if (backend->proxy != NULL)
+    {
+        g_signal_handlers_disconnect_by_data (backend->proxy, backend);
+        g_clear_object (&backend->proxy);
+    }
+
+    if (backend->idle_changed_id != 0)
+    {
+        g_source_remove (backend->idle_changed_id);
+        backend->idle_changed_id = 0;
+    }
+
+    g_clear_object (&backend->reload_cancellable);
+
+    clear_surface_cache (backend);
+    g_clear_pointer (&backend->surface_cache, g_queue_free);
+
+    if (backend->retire_id != 0)
+    {
+        g_source_remove (backend->retire_id);
+        backend->retire_id = 0;
+    }
+
+    end_switch (backend);
+
+    g_slist_free_full (backend->retired, (GDestroyNotify) xapp_kbd_layout_state_unref);
+    backend->retired = NULL;
+    g_clear_pointer (&backend->state, xapp_kbd_layout_state_unref);
+    g_clear_pointer (&backend->store, layout_store_unref);
+    g_clear_pointer (&backend->changed_groups, g_array_unref);
+    g_clear_pointer (&backend->temp_flag_theme_dir, g_free);
+
+    g_slice_free (LayoutBackend, backend);
+}
+
+/* The first controller creates the backend, the others share it */
+static LayoutBackend *
+layout_backend_get_default (void)
+{
+    if (default_backend == NULL)
+    {
+        default_backend = layout_backend_new (_xapp_kbd_layout_dbus_proxy_new ());
+        return default_backend;
+    }
+
+    return layout_backend_ref (default_backend);
+}
+
+static void
+attach_backend (XAppKbdLayoutController *controller,
+                LayoutBackend           *backend)
+{
+    controller->priv->backend = backend;
+    backend->controllers = g_list_prepend (backend->controllers, controller);
+}
+
+static void
+warm_flag_source_thread (GTask        *task,
+                         gpointer      source_object,
+                         gpointer      task_data,
+                         GCancellable *cancellable)
+{
+    get_flag_dir ();
+    _xapp_flag_atlas_get_default ();
+
+    g_task_return_boolean (task, TRUE);
+}
+
+static void
+backend_proxy_ready (GObject      *source,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+    GDBusProxy *proxy = _xapp_kbd_layout_dbus_proxy_new_finish (result);
+    LayoutBackend *backend;
+    GList *tasks, *l;
+
+    tasks = pending_inits;
+    pending_inits = NULL;
+    creating_backend = FALSE;
+
+    /* A controller initialized synchronously in the meantime may have
+     * created it already.
+     */
+    if (default_backend == NULL)
+    {
+        default_backend = layout_backend_new (proxy);
+        backend = default_backend;
+    }
+    else
+    {
+        g_clear_object (&proxy);
+        backend = layout_backend_ref (default_backend);
+    }
+
+    for (l = tasks; l != NULL; l = l->next)
+    {
+        GTask *task = l->data;
+
+        /* The cancellable's source, if it hasn't been dispatched yet */
+        if (g_task_get_task_data (task) != NULL)
+        {
+            g_source_destroy (g_task_get_task_data (task));
+        }
+
+        if (!g_task_return_error_if_cancelled (task))
+        {
+            attach_backend (g_task_get_source_object (task), layout_backend_ref (backend));
+            g_task_return_boolean (task, TRUE);
+        }
+
+        g_object_unref (task);
+    }
+
+    g_list_free (tasks);
+    layout_backend_unref (backend);
+}
+
+/* Cancelled while waiting for the backend - don't make it wait for that */
+static gboolean
+init_cancelled (GCancellable *cancellable,
+                gpointer      user_data)
+{
+    GTask *task = user_data;
+
+    pending_inits = g_list_remove (pending_inits, task);
+
+    g_task_return_error_if_cancelled (task);
+    g_object_unref (task);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+xapp_kbd_layout_controller_init_async (GAsyncInitable      *initable,
+                                       gint                 io_priority,
+                                       GCancellable        *cancellable,
+                                       GAsyncReadyCallback  callback,
+                                       gpointer             user_data)
+{
+    XAppKbdLayoutController *controller = XAPP_KBD_LAYOUT_CONTROLLER (initable);
+    GTask *task;
+
+    task = g_task_new (initable, cancellable, callback, user_data);
+    g_task_set_priority (task, io_priority);
+    g_task_set_source_tag (task, xapp_kbd_layout_controller_init_async);
+
+    if (g_task_return_error_if_cancelled (task))
+    {
+        g_object_unref (task);
+        return;
+    }
+
+    /* Already initialized, or another controller already did the work */
+    if (controller->priv->backend != NULL || default_backend != NULL)
+    {
+        if (controller->priv->backend == NULL)
+        {
+            attach_backend (controller, layout_backend_ref (default_backend));
+        }
+
+        g_task_return_boolean (task, TRUE);
+        g_object_unref (task);
+        return;
+    }
+
+    if (cancellable != NULL)
+    {
+        GSource *source = g_cancellable_source_new (cancellable);
+
+        g_task_attach_source (task, source, (GSourceFunc) init_cancelled);
+        g_task_set_task_data (task, source, (GDestroyNotify) g_source_unref);
+    }
+
+    pending_inits = g_list_append (pending_inits, task);
+
+    if (!creating_backend)
+    {
+        GTask *warm = g_task_new (NULL, NULL, NULL, NULL);
+
+        creating_backend = TRUE;
+
+        /* Nothing waits for this, it just saves the first render the disk
+         * lookups.
+         */
+        g_task_set_priority (warm, G_PRIORITY_LOW);
+        g_task_run_in_thread (warm, warm_flag_source_thread);
+        g_object_unref (warm);
+
+        _xapp_kbd_layout_dbus_proxy_new_async (backend_proxy_ready, NULL);
+    }
+}
+
+static gboolean
+xapp_kbd_layout_controller_init_finish (GAsyncInitable  *initable,
+                                        GAsyncResult    *result,
+                                        GError         **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, initable), FALSE);
+
+    return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/* Constructed controllers are connected already, unless they were made
+ * with init-async - for g_initable_new(), this is where they catch up.
+ */
+static gboolean
+xapp_kbd_layout_controller_initable_init (GInitable     *initable,
+                                          GCancellable  *cancellable,
+                                          GError       **error)
 {
-    XAppKbdLayoutControllerPrivate *priv = controller->priv;
+    XAppKbdLayoutController *controller = XAPP_KBD_LAYOUT_CONTROLLER (initable);
 
-    if (priv->idle_changed_id != 0)
+    if (controller->priv->backend == NULL)
     {
-        g_source_remove (priv->idle_changed_id);
-        priv->idle_changed_id = 0;
+        attach_backend (controller, layout_backend_get_default ());
     }
 
-    priv->idle_changed_id = g_idle_add ((GSourceFunc) idle_config_changed, controller);
+    return TRUE;
 }
 
+static void
+xapp_kbd_layout_controller_initable_iface_init (GInitableIface *iface)
+{
+    iface->init = xapp_kbd_layout_controller_initable_init;
+}
 
 static void
-on_configuration_group_changed (GkbdConfiguration       *config,
-                                gint                     group,
-                                XAppKbdLayoutController *controller)
+xapp_kbd_layout_controller_async_initable_iface_init (GAsyncInitableIface *iface)
 {
-    g_signal_emit (controller, signals[KBD_LAYOUT_CHANGED], 0, (guint) group);
+    iface->init_async = xapp_kbd_layout_controller_init_async;
+    iface->init_finish = xapp_kbd_layout_controller_init_finish;
 }
 
 static void
@@ -387,38 +2484,30 @@ xapp_kbd_layout_controller_init (XAppKbdLayoutController *controller)
 
     XAppKbdLayoutControllerPrivate *priv = controller->priv;
 
-    priv->config = gkbd_configuration_get ();
-    priv->enabled = FALSE;
-    priv->flag_dir = NULL;
-    priv->temp_flag_theme_dir = NULL;
-    priv->idle_changed_id = 0;
+    priv->backend = NULL;
+    priv->model = NULL;
+    priv->model_store = NULL;
+    priv->coalesce_interval = 0;
+    priv->coalesce_id = 0;
+    priv->coalesce_pending = FALSE;
+    priv->emitted_group = 0;
+    priv->init_async = FALSE;
 }
 
+/* Plain g_object_new() (and so the bindings' constructors) gets a working
+ * controller right away - only new_async() defers it.
+ */
 static void
 xapp_kbd_layout_controller_constructed (GObject *object)
 {
-    G_OBJECT_CLASS (xapp_kbd_layout_controller_parent_class)->constructed (object);
-
     XAppKbdLayoutController *controller = XAPP_KBD_LAYOUT_CONTROLLER (object);
-    XAppKbdLayoutControllerPrivate *priv = controller->priv;
-
-    initialize_flag_dir (controller);
-
-    initialize_icon_theme (controller);
 
-    gkbd_configuration_start_listen (priv->config);
-
-    priv->changed_id = g_signal_connect_object (priv->config,
-                                                "changed",
-                                                G_CALLBACK (on_configuration_changed),
-                                                controller, 0);
+    G_OBJECT_CLASS (xapp_kbd_layout_controller_parent_class)->constructed (object);
 
-    priv->group_changed_id = g_signal_connect_object (priv->config,
-                                                      "group-changed",
-                                                      G_CALLBACK (on_configuration_group_changed),
-                                                      controller, 0);
-    clear_stores (controller);
-    load_stores (controller);
+    if (!controller->priv->init_async)
+    {
+        attach_backend (controller, layout_backend_get_default ());
+    }
 }
 
 static void
@@ -428,12 +2517,40 @@ xapp_kbd_layout_controller_get_property (GObject    *gobject,
                                          GParamSpec *pspec)
 {
     XAppKbdLayoutController *controller = XAPP_KBD_LAYOUT_CONTROLLER (gobject);
-    XAppKbdLayoutControllerPrivate *priv = controller->priv;
+    LayoutBackend *backend = controller->priv->backend;
 
     switch (prop_id)
     {
         case PROP_ENABLED:
-            g_value_set_boolean (value, priv->enabled);
+            g_value_set_boolean (value, backend->enabled);
+            break;
+        case PROP_CURRENT_GROUP:
+            g_value_set_uint (value, backend->current_group);
+            break;
+        case PROP_COALESCE_INTERVAL:
+            g_value_set_uint (value, controller->priv->coalesce_interval);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (gobject, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+xapp_kbd_layout_controller_set_property (GObject      *gobject,
+                                         guint         prop_id,
+                                         const GValue *value,
+                                         GParamSpec   *pspec)
+{
+    XAppKbdLayoutController *controller = XAPP_KBD_LAYOUT_CONTROLLER (gobject);
+
+    switch (prop_id)
+    {
+        case PROP_COALESCE_INTERVAL:
+            xapp_kbd_layout_controller_set_coalesce_interval (controller, g_value_get_uint (value));
+            break;
+        case PROP_INIT_ASYNC:
+            controller->priv->init_async = g_value_get_boolean (value);
             break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (gobject, prop_id, pspec);
@@ -447,52 +2564,34 @@ xapp_kbd_layout_controller_dispose (GObject *object)
     XAppKbdLayoutController *controller = XAPP_KBD_LAYOUT_CONTROLLER (object);
     XAppKbdLayoutControllerPrivate *priv = controller->priv;
 
-    gkbd_configuration_stop_listen (priv->config);
-
-    clear_stores (controller);
-
-    if (priv->changed_id > 0)
+    if (priv->coalesce_id != 0)
     {
-        g_signal_handler_disconnect (priv->config, priv->changed_id);
-        priv->changed_id = 0;
+        g_source_remove (priv->coalesce_id);
+        priv->coalesce_id = 0;
     }
 
-    if (priv->group_changed_id > 0)
+    if (priv->backend != NULL)
     {
-        g_signal_handler_disconnect (priv->config, priv->group_changed_id);
-        priv->group_changed_id = 0;
+        priv->backend->controllers = g_list_remove (priv->backend->controllers, controller);
+        g_clear_pointer (&priv->backend, layout_backend_unref);
     }
 
-    if (priv->idle_changed_id != 0)
-    {
-        g_source_remove (priv->idle_changed_id);
-        priv->idle_changed_id = 0;
-    }
+    g_clear_pointer (&priv->model_store, layout_store_unref);
+    g_clear_object (&priv->model);
 
     G_OBJECT_CLASS (xapp_kbd_layout_controller_parent_class)->dispose (object);
 }
 
-static void
-xapp_kbd_layout_controller_finalize (GObject *object)
-{
-    XAppKbdLayoutController *controller = XAPP_KBD_LAYOUT_CONTROLLER (object);
-    XAppKbdLayoutControllerPrivate *priv = controller->priv;
-
-    g_clear_object (&priv->config);
-    g_clear_pointer (&priv->flag_dir, g_free);
-    g_clear_pointer (&priv->temp_flag_theme_dir, g_free);
-
-    G_OBJECT_CLASS (xapp_kbd_layout_controller_parent_class)->finalize (object);
-}
-
 static void
 xapp_kbd_layout_controller_class_init (XAppKbdLayoutControllerClass *klass)
 {
     GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
 
+    _xapp_trace_init ();
+
     gobject_class->dispose = xapp_kbd_layout_controller_dispose;
-    gobject_class->finalize = xapp_kbd_layout_controller_finalize;
     gobject_class->get_property = xapp_kbd_layout_controller_get_property;
+    gobject_class->set_property = xapp_kbd_layout_controller_set_property;
     gobject_class->constructed = xapp_kbd_layout_controller_constructed;
 
     g_type_class_add_private (gobject_class, sizeof (XAppKbdLayoutControllerPrivate));
@@ -505,6 +2604,38 @@ xapp_kbd_layout_controller_class_init (XAppKbdLayoutControllerClass *klass)
                                                            G_PARAM_READABLE)
                                     );
 
+    g_object_class_install_property (gobject_class, PROP_CURRENT_GROUP,
+                                     g_param_spec_uint ("current-group",
+                                                        "Current group",
+                                                        "The index of the active keyboard layout",
+                                                        0, G_MAXUINT, 0,
+                                                        G_PARAM_READABLE)
+                                    );
+
+    g_object_class_install_property (gobject_class, PROP_COALESCE_INTERVAL,
+                                     g_param_spec_uint ("coalesce-interval",
+                                                        "Coalesce interval",
+                                                        "The minimum time, in milliseconds, between layout-changed emissions (0 to emit every switch)",
+                                                        0, G_MAXUINT, 0,
+                                                        G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY)
+                                    );
+
+    /**
+     * XAppKbdLayoutController:init-async:
+     *
+     * Set by xapp_kbd_layout_controller_new_async(), which leaves connecting
+     * the controller to g_async_initable_init_async().  Don't set it
+     * otherwise - a controller constructed with it is unusable until
+     * initialized.
+     */
+    g_object_class_install_property (gobject_class, PROP_INIT_ASYNC,
+                                     g_param_spec_boolean ("init-async",
+                                                           "Initialize asynchronously",
+                                                           "Whether the controller is connected by g_async_initable_init_async()",
+                                                           FALSE,
+                                                           G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY)
+                                    );
+
     signals[KBD_LAYOUT_CHANGED] = g_signal_new ("layout-changed",
                                                 G_TYPE_FROM_CLASS (gobject_class),
                                                 G_SIGNAL_RUN_LAST,
@@ -527,54 +2658,111 @@ xapp_kbd_layout_controller_class_init (XAppKbdLayoutControllerClass *klass)
 XAppKbdLayoutController *
 xapp_kbd_layout_controller_new (void)
 {
-    return g_object_new (XAPP_TYPE_KBD_LAYOUT_CONTROLLER, NULL);
+    return g_initable_new (XAPP_TYPE_KBD_LAYOUT_CONTROLLER, NULL, NULL, NULL);
+}
+
+/**
+ * xapp_kbd_layout_controller_new_async:
+ * @cancellable: (nullable): a #GCancellable, or NULL
+ * @callback: called when the controller is ready
+ * @user_data: data for @callback
+ *
+ * Creates a controller without blocking the main loop.  The first
+ * controller in a process connects to the session keyboard layout
+ * service asynchronously, and looks up the flags in a thread.  Once
+ * @callback runs, call xapp_kbd_layout_controller_new_finish() to get it.
+ *
+ * Names are available as soon as the controller is.  No flag is rendered
+ * up front, not even for the items of
+ * xapp_kbd_layout_controller_get_model() - each one is rendered the first
+ * time it's asked for, through a getter, a state snapshot or an item.
+ *
+ * If @cancellable is cancelled before the controller is ready, @callback
+ * runs right away, and xapp_kbd_layout_controller_new_finish() returns
+ * %G_IO_ERROR_CANCELLED.
+ */
+void
+xapp_kbd_layout_controller_new_async (GCancellable        *cancellable,
+                                      GAsyncReadyCallback  callback,
+                                      gpointer             user_data)
+{
+    g_async_initable_new_async (XAPP_TYPE_KBD_LAYOUT_CONTROLLER,
+                                G_PRIORITY_DEFAULT,
+                                cancellable,
+                                callback,
+                                user_data,
+                                "init-async", TRUE,
+                                NULL);
+}
+
+/**
+ * xapp_kbd_layout_controller_new_finish:
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for an error, or NULL
+ *
+ * Finishes xapp_kbd_layout_controller_new_async().
+ *
+ * Returns: (transfer full): the new #XAppKbdLayoutController, or NULL
+ * if it was cancelled.
+ */
+XAppKbdLayoutController *
+xapp_kbd_layout_controller_new_finish (GAsyncResult  *result,
+                                       GError       **error)
+{
+    GObject *source, *object;
+
+    source = g_async_result_get_source_object (result);
+    object = g_async_initable_new_finish (G_ASYNC_INITABLE (source), result, error);
+    g_object_unref (source);
+
+    return object != NULL ? XAPP_KBD_LAYOUT_CONTROLLER (object) : NULL;
 }
 
 gboolean
 xapp_kbd_layout_controller_get_enabled (XAppKbdLayoutController *controller)
 {
-    return controller->priv->enabled;
+    return controller->priv->backend->enabled;
 }
 
 guint
 xapp_kbd_layout_controller_get_current_group (XAppKbdLayoutController *controller)
 {
-    g_return_val_if_fail (controller->priv->enabled, 0);
+    g_return_val_if_fail (controller->priv->backend->enabled, 0);
 
-    return gkbd_configuration_get_current_group (controller->priv->config);
+    return controller->priv->backend->current_group;
 }
 
 void
 xapp_kbd_layout_controller_set_current_group (XAppKbdLayoutController *controller,
                                               guint                    group)
 {
-    g_return_if_fail (controller->priv->enabled);
-    g_return_if_fail (group <= controller->priv->num_groups);
-
-    guint current = gkbd_configuration_get_current_group (controller->priv->config);
+    g_return_if_fail (controller->priv->backend->enabled);
+    g_return_if_fail (group < controller->priv->backend->num_groups);
 
-    if (current != group)
+    if (controller->priv->backend->current_group != group)
     {
-        gkbd_configuration_lock_group (controller->priv->config, group);
+        lock_group (controller->priv->backend, group);
     }
 }
 
 void
 xapp_kbd_layout_controller_next_group (XAppKbdLayoutController *controller)
 {
-    g_return_if_fail (controller->priv->enabled);
+    g_return_if_fail (controller->priv->backend->enabled);
 
-    gkbd_configuration_lock_next_group (controller->priv->config);
+    LayoutBackend *backend = controller->priv->backend;
+
+    lock_group (backend, (get_switch_base (backend) + 1) % backend->num_groups);
 }
 
 void
 xapp_kbd_layout_controller_previous_group (XAppKbdLayoutController *controller)
 {
-    g_return_if_fail (controller->priv->enabled);
+    g_return_if_fail (controller->priv->backend->enabled);
 
-    XAppKbdLayoutControllerPrivate *priv = controller->priv;
+    LayoutBackend *backend = controller->priv->backend;
 
-    gint current = gkbd_configuration_get_current_group (priv->config);
+    gint current = get_switch_base (backend);
 
     if (current > 0)
     {
@@ -582,10 +2770,10 @@ xapp_kbd_layout_controller_previous_group (XAppKbdLayoutController *controller)
     }
     else
     {
-        current = priv->num_groups - 1;
+        current = backend->num_groups - 1;
     }
 
-    gkbd_configuration_lock_group (controller->priv->config, current);
+    lock_group (backend, current);
 }
 
 /**
@@ -599,24 +2787,29 @@ xapp_kbd_layout_controller_previous_group (XAppKbdLayoutController *controller)
 gchar *
 xapp_kbd_layout_controller_get_current_name (XAppKbdLayoutController *controller)
 {
-    g_return_val_if_fail (controller->priv->enabled, NULL);
+    g_return_val_if_fail (controller->priv->backend->enabled, NULL);
 
-    return gkbd_configuration_get_current_tooltip (controller->priv->config);
+    LayoutBackend *backend = controller->priv->backend;
+
+    g_return_val_if_fail (backend->current_group < backend->num_groups, NULL);
+
+    return g_strdup (backend->store->full_names[backend->current_group]);
 }
 
 /**
  * xapp_kbd_layout_controller_get_all_names:
  *
- * Returns an array of all full layout names
+ * Returns an array of all full layout names.  The array is owned by the
+ * controller, and stays valid until the next #XAppKbdLayoutController::config-changed.
  *
  * Returns: (transfer none) (array zero-terminated=1): array of names
  */
 gchar **
 xapp_kbd_layout_controller_get_all_names (XAppKbdLayoutController *controller)
 {
-    g_return_val_if_fail (controller->priv->enabled, NULL);
+    g_return_val_if_fail (controller->priv->backend->enabled, NULL);
 
-    return gkbd_configuration_get_group_names (controller->priv->config);
+    return controller->priv->backend->store->full_names;
 }
 
 /**
@@ -629,13 +2822,17 @@ xapp_kbd_layout_controller_get_all_names (XAppKbdLayoutController *controller)
 gchar *
 xapp_kbd_layout_controller_get_current_icon_name (XAppKbdLayoutController *controller)
 {
-    g_return_val_if_fail (controller->priv->enabled, NULL);
+    g_return_val_if_fail (controller->priv->backend->enabled, NULL);
 
-    XAppKbdLayoutControllerPrivate *priv = controller->priv;
+    LayoutBackend *backend = controller->priv->backend;
+
+    guint current = backend->current_group;
 
-    guint current = gkbd_configuration_get_current_group (priv->config);
+    g_return_val_if_fail (current < backend->num_groups, NULL);
 
-    return g_strdup (priv->icon_names[current]);
+    save_icon_names (backend);
+
+    return g_strdup (get_group_data (backend, current)->icon_name);
 }
 
 
@@ -649,12 +2846,61 @@ xapp_kbd_layout_controller_get_current_icon_name (XAppKbdLayoutController *contr
 gchar *
 xapp_kbd_layout_controller_get_icon_name_for_group (XAppKbdLayoutController *controller, guint group)
 {
-    g_return_val_if_fail (controller->priv->enabled, NULL);
-    g_return_val_if_fail (group <= controller->priv->num_groups, NULL);
+    g_return_val_if_fail (controller->priv->backend->enabled, NULL);
+    g_return_val_if_fail (group < controller->priv->backend->num_groups, NULL);
 
-    XAppKbdLayoutControllerPrivate *priv = controller->priv;
+    save_icon_names (controller->priv->backend);
+
+    return g_strdup (get_group_data (controller->priv->backend, group)->icon_name);
+}
+
+/**
+ * xapp_kbd_layout_controller_get_current_icon:
+ *
+ * Returns an in-memory icon for the current layout.  Unlike
+ * xapp_kbd_layout_controller_get_current_icon_name(), this never
+ * writes to disk or touches the icon theme.
+ *
+ * Returns: (transfer full): a #GIcon, or NULL if there is no flag
+ * for the layout.
+ */
+GIcon *
+xapp_kbd_layout_controller_get_current_icon (XAppKbdLayoutController *controller)
+{
+    g_return_val_if_fail (controller->priv->backend->enabled, NULL);
+
+    LayoutBackend *backend = controller->priv->backend;
+
+    guint current = backend->current_group;
+
+    return xapp_kbd_layout_controller_get_icon_for_group (controller, current);
+}
+
+/**
+ * xapp_kbd_layout_controller_get_icon_for_group:
+ *
+ * Returns an in-memory icon for the specified layout.  Unlike
+ * xapp_kbd_layout_controller_get_icon_name_for_group(), this never
+ * writes to disk or touches the icon theme.
+ *
+ * Returns: (transfer full): a #GIcon, or NULL if there is no flag
+ * for the layout.
+ */
+GIcon *
+xapp_kbd_layout_controller_get_icon_for_group (XAppKbdLayoutController *controller,
+                                               guint                    group)
+{
+    g_return_val_if_fail (controller->priv->backend->enabled, NULL);
+    g_return_val_if_fail (group < controller->priv->backend->num_groups, NULL);
+
+    GdkPixbuf *pixbuf = ensure_pixbuf (controller->priv->backend, group);
+
+    if (pixbuf == NULL)
+    {
+        return NULL;
+    }
 
-    return g_strdup (priv->icon_names[group]);
+    return G_ICON (g_object_ref (pixbuf));
 }
 
 /**
@@ -667,13 +2913,15 @@ xapp_kbd_layout_controller_get_icon_name_for_group (XAppKbdLayoutController *con
 gchar *
 xapp_kbd_layout_controller_get_short_name (XAppKbdLayoutController *controller)
 {
-    g_return_val_if_fail (controller->priv->enabled, NULL);
+    g_return_val_if_fail (controller->priv->backend->enabled, NULL);
 
-    XAppKbdLayoutControllerPrivate *priv = controller->priv;
+    LayoutBackend *backend = controller->priv->backend;
 
-    guint current = gkbd_configuration_get_current_group (priv->config);
+    guint current = backend->current_group;
 
-    return g_strdup (priv->text_store[current]);
+    g_return_val_if_fail (current < backend->num_groups, NULL);
+
+    return g_strdup (get_group_data (backend, current)->text);
 }
 
 /**
@@ -687,11 +2935,341 @@ gchar *
 xapp_kbd_layout_controller_get_short_name_for_group (XAppKbdLayoutController *controller,
                                                      guint group)
 {
-    g_return_val_if_fail (controller->priv->enabled, NULL);
+    g_return_val_if_fail (controller->priv->backend->enabled, NULL);
+    g_return_val_if_fail (group < controller->priv->backend->num_groups, NULL);
+
+    return g_strdup (get_group_data (controller->priv->backend, group)->text);
+}
+
+/**
+ * xapp_kbd_layout_controller_get_surface_for_group:
+ * @controller: the #XAppKbdLayoutController
+ * @group: the group
+ * @size: the logical size, in pixels, the flag needs to fit in
+ * @scale: the scale factor of the target surface
+ *
+ * Renders the flag (and duplicate number, if any) for the specified group
+ * directly at @size x @scale device pixels, so it doesn't need to be
+ * rescaled when drawn.  The flag keeps its aspect ratio within a
+ * @size x @size square, and the device scale of the surface is set to
+ * @scale.
+ *
+ * @size x @scale can't be more than 1024.
+ *
+ * Recently used sizes are cached, so this is cheap to call on every draw.
+ * The surface is shared with the cache and other callers, so it must be
+ * treated as read-only - paint from it, but never draw on it.
+ *
+ * Returns: (transfer full): a cairo surface, or NULL if there is no flag
+ * for the layout.
+ */
+cairo_surface_t *
+xapp_kbd_layout_controller_get_surface_for_group (XAppKbdLayoutController *controller,
+                                                  guint                    group,
+                                                  guint                    size,
+                                                  guint                    scale)
+{
+    g_return_val_if_fail (controller->priv->backend->enabled, NULL);
+    g_return_val_if_fail (group < controller->priv->backend->num_groups, NULL);
+    g_return_val_if_fail (size > 0 && scale > 0, NULL);
+    g_return_val_if_fail (size <= SURFACE_MAX_SIZE / scale, NULL);
+
+    cairo_surface_t *surface = lookup_sized_surface (controller->priv->backend, group, size, scale);
+
+    if (surface == NULL)
+    {
+        return NULL;
+    }
+
+    return cairo_surface_reference (surface);
+}
+
+/**
+ * xapp_kbd_layout_controller_get_changed_groups:
+ * @controller: the #XAppKbdLayoutController
+ * @n_groups: (out): return location for the number of indices
+ *
+ * Returns the indices of the groups affected by the last configuration
+ * change - ones whose name, flag or duplicate number changed, and ones
+ * that were added or removed.  This is meant to be called from a
+ * #XAppKbdLayoutController::config-changed handler, so consumers can
+ * refresh only what changed.
+ *
+ * Returns: (array length=n_groups) (transfer none): the indices, owned
+ * by @controller.
+ */
+const guint *
+xapp_kbd_layout_controller_get_changed_groups (XAppKbdLayoutController *controller,
+                                               guint                   *n_groups)
+{
+    g_return_val_if_fail (XAPP_IS_KBD_LAYOUT_CONTROLLER (controller), NULL);
+    g_return_val_if_fail (n_groups != NULL, NULL);
+
+    GArray *changed = controller->priv->backend->changed_groups;
+
+    if (changed == NULL || changed->len == 0)
+    {
+        *n_groups = 0;
+        return NULL;
+    }
+
+    *n_groups = changed->len;
+
+    return (const guint *) changed->data;
+}
+
+/**
+ * xapp_kbd_layout_controller_get_switch_latency:
+ * @controller: the #XAppKbdLayoutController
+ *
+ * Returns the time it took the last group switch requested through a
+ * controller in this process (xapp_kbd_layout_controller_set_current_group(),
+ * xapp_kbd_layout_controller_next_group() or
+ * xapp_kbd_layout_controller_previous_group()) to come back as a
+ * #XAppKbdLayoutController::layout-changed.  Switches that fail, end on
+ * another group, or don't come back within a second aren't measured.
+ *
+ * Returns: the latency in microseconds, or -1 if no switch has been
+ * measured yet.
+ */
+gint64
+xapp_kbd_layout_controller_get_switch_latency (XAppKbdLayoutController *controller)
+{
+    g_return_val_if_fail (XAPP_IS_KBD_LAYOUT_CONTROLLER (controller), -1);
+
+    return controller->priv->backend->switch_latency;
+}
+
+/**
+ * xapp_kbd_layout_controller_set_coalesce_interval:
+ * @controller: the #XAppKbdLayoutController
+ * @interval: the minimum time between emissions, in milliseconds, or 0
+ *
+ * By default #XAppKbdLayoutController::layout-changed is emitted for every
+ * group switch.  With a non-zero @interval, the first switch is still
+ * emitted right away, but then at most one emission per @interval
+ * follows, carrying the group the switches in between ended on - so
+ * holding the switch key or cycling through layouts doesn't cost a redraw
+ * for every intermediate layout.  Something around 16 gives one emission
+ * per frame.
+ *
+ * This only affects @controller, other controllers in the process keep
+ * their own setting.
+ */
+void
+xapp_kbd_layout_controller_set_coalesce_interval (XAppKbdLayoutController *controller,
+                                                  guint                    interval)
+{
+    g_return_if_fail (XAPP_IS_KBD_LAYOUT_CONTROLLER (controller));
+
+    XAppKbdLayoutControllerPrivate *priv = controller->priv;
+
+    if (priv->coalesce_interval == interval)
+    {
+        return;
+    }
+
+    /* Don't lose a held back switch */
+    if (priv->coalesce_id != 0)
+    {
+        g_source_remove (priv->coalesce_id);
+        priv->coalesce_id = 0;
+
+        flush_coalesced (controller);
+    }
+
+    priv->coalesce_interval = interval;
+
+    g_object_notify (G_OBJECT (controller), "coalesce-interval");
+}
+
+/**
+ * xapp_kbd_layout_controller_get_coalesce_interval:
+ * @controller: the #XAppKbdLayoutController
+ *
+ * Returns: the layout-changed coalescing interval, in milliseconds, or
+ * 0 if every switch is emitted.
+ */
+guint
+xapp_kbd_layout_controller_get_coalesce_interval (XAppKbdLayoutController *controller)
+{
+    g_return_val_if_fail (XAPP_IS_KBD_LAYOUT_CONTROLLER (controller), 0);
+
+    return controller->priv->coalesce_interval;
+}
+
+/**
+ * xapp_kbd_layout_controller_get_model:
+ *
+ * Returns a list of #XAppKbdLayoutItem, one per layout, suitable for
+ * gtk_list_box_bind_model() and the like.  When the configuration changes,
+ * only the items for layouts that actually changed are replaced, and
+ * switching layouts only updates the #XAppKbdLayoutItem:active property
+ * of the affected items.  The list is empty if the controller is disabled.
+ *
+ * Returns: (transfer none): a #GListModel owned by @controller.
+ */
+GListModel *
+xapp_kbd_layout_controller_get_model (XAppKbdLayoutController *controller)
+{
+    g_return_val_if_fail (XAPP_IS_KBD_LAYOUT_CONTROLLER (controller), NULL);
 
     XAppKbdLayoutControllerPrivate *priv = controller->priv;
 
-    g_return_val_if_fail (group < controller->priv->num_groups, NULL);
+    if (priv->model == NULL)
+    {
+        priv->model = g_list_store_new (XAPP_TYPE_KBD_LAYOUT_ITEM);
+        sync_model (controller);
+    }
+
+    return G_LIST_MODEL (priv->model);
+}
+
+G_DEFINE_BOXED_TYPE (XAppKbdLayoutState, xapp_kbd_layout_state, xapp_kbd_layout_state_ref, xapp_kbd_layout_state_unref);
+
+/**
+ * xapp_kbd_layout_controller_get_state:
+ *
+ * Returns a snapshot of all layout state - the group count, the current
+ * group, and the names and icon of every group.  A new snapshot is
+ * published whenever the configuration or the current group changes, so
+ * calling this from a redraw handler is cheap.  A group switch only
+ * costs a small allocation - the names and icons are shared with the
+ * previous snapshot, not rebuilt.
+ *
+ * This can be called from any thread, and never blocks - it only takes a
+ * reference on the latest snapshot.  The snapshot itself is immutable and
+ * can be handed to other threads as well.
+ *
+ * Returns: (transfer full): a new reference to an #XAppKbdLayoutState.
+ */
+XAppKbdLayoutState *
+xapp_kbd_layout_controller_get_state (XAppKbdLayoutController *controller)
+{
+    g_return_val_if_fail (XAPP_IS_KBD_LAYOUT_CONTROLLER (controller), NULL);
+
+    LayoutBackend *backend = controller->priv->backend;
+    XAppKbdLayoutState *state;
+
+    g_atomic_int_inc (&backend->readers);
+    state = xapp_kbd_layout_state_ref (g_atomic_pointer_get (&backend->state));
+    g_atomic_int_add (&backend->readers, -1);
+
+    return state;
+}
+
+/**
+ * xapp_kbd_layout_state_ref:
+ *
+ * Increases the reference count of @state.
+ *
+ * Returns: (transfer full): @state
+ */
+XAppKbdLayoutState *
+xapp_kbd_layout_state_ref (XAppKbdLayoutState *state)
+{
+    g_return_val_if_fail (state != NULL, NULL);
+
+    g_atomic_int_inc (&state->ref_count);
+
+    return state;
+}
+
+/**
+ * xapp_kbd_layout_state_unref:
+ *
+ * Decreases the reference count of @state, freeing it when it reaches 0.
+ */
+void
+xapp_kbd_layout_state_unref (XAppKbdLayoutState *state)
+{
+    g_return_if_fail (state != NULL);
+
+    if (g_atomic_int_dec_and_test (&state->ref_count))
+    {
+        layout_store_unref (state->store);
+        g_slice_free (XAppKbdLayoutState, state);
+    }
+}
+
+/**
+ * xapp_kbd_layout_state_get_num_groups:
+ *
+ * Returns the number of groups, or 0 if there is only a single layout
+ * (and the controller is disabled).
+ */
+guint
+xapp_kbd_layout_state_get_num_groups (XAppKbdLayoutState *state)
+{
+    g_return_val_if_fail (state != NULL, 0);
+
+    return state->store->groups != NULL ? state->store->groups->len : 0;
+}
+
+/**
+ * xapp_kbd_layout_state_get_current_group:
+ *
+ * Returns the group that was current when the snapshot was taken.
+ */
+guint
+xapp_kbd_layout_state_get_current_group (XAppKbdLayoutState *state)
+{
+    g_return_val_if_fail (state != NULL, 0);
+
+    return state->current_group;
+}
+
+/**
+ * xapp_kbd_layout_state_peek_name:
+ *
+ * Returns the full name of the specified group.
+ *
+ * Returns: (transfer none): the name, owned by @state.
+ */
+const gchar *
+xapp_kbd_layout_state_peek_name (XAppKbdLayoutState *state,
+                                 guint               group)
+{
+    g_return_val_if_fail (group < xapp_kbd_layout_state_get_num_groups (state), NULL);
+
+    return state->store->full_names[group];
+}
+
+/**
+ * xapp_kbd_layout_state_peek_short_name:
+ *
+ * Returns the short name (and subscript, if any) of the specified group.
+ *
+ * Returns: (transfer none): the short name, owned by @state.
+ */
+const gchar *
+xapp_kbd_layout_state_peek_short_name (XAppKbdLayoutState *state,
+                                       guint               group)
+{
+    g_return_val_if_fail (group < xapp_kbd_layout_state_get_num_groups (state), NULL);
+
+    GroupData *data = g_ptr_array_index (state->store->groups, group);
+
+    return data->text;
+}
+
+/**
+ * xapp_kbd_layout_state_peek_icon:
+ *
+ * Returns the in-memory icon of the specified group.  The flag is rendered
+ * the first time it's asked for - this is safe from any thread, concurrent
+ * callers wait for the one rendering it.
+ *
+ * Returns: (transfer none): a #GIcon owned by @state, or NULL if there is
+ * no flag for the layout.
+ */
+GIcon *
+xapp_kbd_layout_state_peek_icon (XAppKbdLayoutState *state,
+                                 guint               group)
+{
+    g_return_val_if_fail (group < xapp_kbd_layout_state_get_num_groups (state), NULL);
+
+    GdkPixbuf *pixbuf = layout_store_ensure_pixbuf (state->store, group);
 
-    return g_strdup (priv->text_store[group]);
+    return pixbuf != NULL ? G_ICON (pixbuf) : NULL;
 }
@@ -3,9 +3,13 @@
 
 #include <stdio.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
+#include <gio/gio.h>
+#include <cairo.h>
 
 #include <glib-object.h>
 
+#include "xapp-kbd-layout-item.h"
+
 G_BEGIN_DECLS
 
 #define XAPP_TYPE_KBD_LAYOUT_CONTROLLER            (xapp_kbd_layout_controller_get_type ())
@@ -15,6 +19,10 @@ G_BEGIN_DECLS
 #define XAPP_IS_KBD_LAYOUT_CONTROLLER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  XAPP_TYPE_KBD_LAYOUT_CONTROLLER))
 #define XAPP_KBD_LAYOUT_CONTROLLER_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  XAPP_TYPE_KBD_LAYOUT_CONTROLLER, XAppKbdLayoutControllerClass))
 
+#define XAPP_TYPE_KBD_LAYOUT_STATE                 (xapp_kbd_layout_state_get_type ())
+
+typedef struct _XAppKbdLayoutState XAppKbdLayoutState;
+
 typedef struct _XAppKbdLayoutControllerPrivate XAppKbdLayoutControllerPrivate;
 typedef struct _XAppKbdLayoutController XAppKbdLayoutController;
 typedef struct _XAppKbdLayoutControllerClass XAppKbdLayoutControllerClass;
@@ -33,6 +41,11 @@ struct _XAppKbdLayoutControllerClass
 
 GType                    xapp_kbd_layout_controller_get_type                 (void);
 XAppKbdLayoutController *xapp_kbd_layout_controller_new                      (void);
+void                     xapp_kbd_layout_controller_new_async                (GCancellable            *cancellable,
+                                                                              GAsyncReadyCallback      callback,
+                                                                              gpointer                 user_data);
+XAppKbdLayoutController *xapp_kbd_layout_controller_new_finish               (GAsyncResult            *result,
+                                                                              GError                 **error);
 gboolean                 xapp_kbd_layout_controller_get_enabled              (XAppKbdLayoutController *controller);
 guint                    xapp_kbd_layout_controller_get_current_group        (XAppKbdLayoutController *controller);
 void                     xapp_kbd_layout_controller_set_current_group        (XAppKbdLayoutController *controller,
@@ -44,9 +57,36 @@ gchar                  **xapp_kbd_layout_controller_get_all_names            (XA
 gchar                   *xapp_kbd_layout_controller_get_current_icon_name    (XAppKbdLayoutController *controller);
 gchar                   *xapp_kbd_layout_controller_get_icon_name_for_group  (XAppKbdLayoutController *controller,
                                                                               guint                    group);
+GIcon                   *xapp_kbd_layout_controller_get_current_icon         (XAppKbdLayoutController *controller);
+GIcon                   *xapp_kbd_layout_controller_get_icon_for_group       (XAppKbdLayoutController *controller,
+                                                                              guint                    group);
+cairo_surface_t         *xapp_kbd_layout_controller_get_surface_for_group    (XAppKbdLayoutController *controller,
+                                                                              guint                    group,
+                                                                              guint                    size,
+                                                                              guint                    scale);
 gchar                   *xapp_kbd_layout_controller_get_short_name           (XAppKbdLayoutController *controller);
 gchar                   *xapp_kbd_layout_controller_get_short_name_for_group (XAppKbdLayoutController *controller,
                                                                               guint                    group);
+XAppKbdLayoutState      *xapp_kbd_layout_controller_get_state                (XAppKbdLayoutController *controller);
+GListModel              *xapp_kbd_layout_controller_get_model                (XAppKbdLayoutController *controller);
+const guint             *xapp_kbd_layout_controller_get_changed_groups       (XAppKbdLayoutController *controller,
+                                                                              guint                   *n_groups);
+gint64                   xapp_kbd_layout_controller_get_switch_latency       (XAppKbdLayoutController *controller);
+void                     xapp_kbd_layout_controller_set_coalesce_interval    (XAppKbdLayoutController *controller,
+                                                                              guint                    interval);
+guint                    xapp_kbd_layout_controller_get_coalesce_interval    (XAppKbdLayoutController *controller);
+
+GType                    xapp_kbd_layout_state_get_type                      (void);
+XAppKbdLayoutState      *xapp_kbd_layout_state_ref                           (XAppKbdLayoutState      *state);
+void                     xapp_kbd_layout_state_unref                         (XAppKbdLayoutState      *state);
+guint                    xapp_kbd_layout_state_get_num_groups                (XAppKbdLayoutState      *state);
+guint                    xapp_kbd_layout_state_get_current_group             (XAppKbdLayoutState      *state);
+const gchar             *xapp_kbd_layout_state_peek_name                     (XAppKbdLayoutState      *state,
+                                                                              guint                    group);
+const gchar             *xapp_kbd_layout_state_peek_short_name               (XAppKbdLayoutState      *state,
+                                                                              guint                    group);
+GIcon                   *xapp_kbd_layout_state_peek_icon                     (XAppKbdLayoutState      *state,
+                                                                              guint                    group);
 
 G_END_DECLS
 
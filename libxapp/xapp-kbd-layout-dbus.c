@@ -0,0 +1,257 @@
+#include <config.h>
+
+#include <gio/gio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "xapp-kbd-layout-dbus.h"
+
+/* The session service owns the only GkbdConfiguration listener and renders
+ * the flags once for everyone.  Clients mirror GroupNames and FullNames
+ * into their own stores, follow CurrentGroup, and fetch the rendered
+ * flags with GetIcon from worker threads, rendering locally until they
+ * arrive.  The name and short name that GetIcon returns let clients
+ * notice when the group list changed under them.
+ */
+static const gchar introspection_xml[] =
+    "<node>"
+    "  <interface name='" XAPP_KBD_LAYOUT_DBUS_INTERFACE "'>"
+    "    <method name='SetCurrentGroup'>"
+    "      <arg type='u' name='group' direction='in'/>"
+    "    </method>"
+    "    <method name='NextGroup'/>"
+    "    <method name='PreviousGroup'/>"
+    "    <method name='GetIcon'>"
+    "      <arg type='u' name='group' direction='in'/>"
+    "      <arg type='s' name='name' direction='out'/>"
+    "      <arg type='s' name='short_name' direction='out'/>"
+    "      <arg type='(iiibiiay)' name='image' direction='out'/>"
+    "    </method>"
+    "    <signal name='LayoutChanged'>"
+    "      <arg type='u' name='group'/>"
+    "    </signal>"
+    "    <property name='GroupNames' type='as' access='read'/>"
+    "    <property name='FullNames' type='as' access='read'/>"
+    "    <property name='CurrentGroup' type='u' access='read'/>"
+    "  </interface>"
+    "</node>";
+
+G_LOCK_DEFINE_STATIC (node_info);
+static GDBusNodeInfo *node_info = NULL;
+
+GDBusInterfaceInfo *
+_xapp_kbd_layout_dbus_get_interface_info (void)
+{
+    GDBusInterfaceInfo *info;
+
+    G_LOCK (node_info);
+
+    if (node_info == NULL)
+    {
+        node_info = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
+    }
+
+    info = node_info->interfaces[0];
+
+    G_UNLOCK (node_info);
+
+    return info;
+}
+
+/* Takes ownership of proxy, and returns it if the service is running and
+ * has published its groups, or NULL otherwise.
+ */
+static GDBusProxy *
+check_proxy (GDBusProxy *proxy)
+{
+    GVariant *names;
+    gchar *owner;
+
+    owner = g_dbus_proxy_get_name_owner (proxy);
+
+    if (owner == NULL)
+    {
+        g_object_unref (proxy);
+        return NULL;
+    }
+
+    g_free (owner);
+
+    /* Not usable until the service has published its groups */
+    names = g_dbus_proxy_get_cached_property (proxy, "GroupNames");
+
+    if (names == NULL)
+    {
+        g_object_unref (proxy);
+        return NULL;
+    }
+
+    g_variant_unref (names);
+
+    return proxy;
+}
+
+/* Returns a proxy for the session service if it's already running, or
+ * NULL if it isn't (or it's disabled through the environment) and the
+ * caller should work in-process.  This never starts the service - that
+ * would block the caller until it's up - the async version does.
+ */
+GDBusProxy *
+_xapp_kbd_layout_dbus_proxy_new (void)
+{
+    GDBusProxy *proxy;
+    GError *error = NULL;
+
+    if (g_getenv (XAPP_KBD_LAYOUT_LOCAL_ENV) != NULL)
+    {
+        return NULL;
+    }
+
+    proxy = g_dbus_proxy_new_for_bus_sync (G_BUS_TYPE_SESSION,
+                                           G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
+                                           _xapp_kbd_layout_dbus_get_interface_info (),
+                                           XAPP_KBD_LAYOUT_DBUS_NAME,
+                                           XAPP_KBD_LAYOUT_DBUS_PATH,
+                                           XAPP_KBD_LAYOUT_DBUS_INTERFACE,
+                                           NULL,
+                                           &error);
+
+    if (proxy == NULL)
+    {
+        g_debug ("Keyboard layout service unavailable: %s", error->message);
+        g_error_free (error);
+        return NULL;
+    }
+
+    return check_proxy (proxy);
+}
+
+static void
+proxy_ready (GObject      *source,
+             GAsyncResult *result,
+             gpointer      user_data)
+{
+    GTask *task = G_TASK (user_data);
+    GDBusProxy *proxy;
+    GError *error = NULL;
+
+    proxy = g_dbus_proxy_new_for_bus_finish (result, &error);
+
+    if (proxy == NULL)
+    {
+        g_debug ("Keyboard layout service unavailable: %s", error->message);
+        g_error_free (error);
+    }
+    else
+    {
+        proxy = check_proxy (proxy);
+    }
+
+    g_task_return_pointer (task, proxy, g_object_unref);
+    g_object_unref (task);
+}
+
+/* Like _xapp_kbd_layout_dbus_proxy_new(), but doesn't block on the bus,
+ * so it can start the service if it's installed but not running yet.
+ */
+void
+_xapp_kbd_layout_dbus_proxy_new_async (GAsyncReadyCallback callback,
+                                       gpointer            user_data)
+{
+    GTask *task = g_task_new (NULL, NULL, callback, user_data);
+
+    if (g_getenv (XAPP_KBD_LAYOUT_LOCAL_ENV) != NULL)
+    {
+        g_task_return_pointer (task, NULL, NULL);
+        g_object_unref (task);
+        return;
+    }
+
+    g_dbus_proxy_new_for_bus (G_BUS_TYPE_SESSION,
+                              G_DBUS_PROXY_FLAGS_NONE,
+                              _xapp_kbd_layout_dbus_get_interface_info (),
+                              XAPP_KBD_LAYOUT_DBUS_NAME,
+                              XAPP_KBD_LAYOUT_DBUS_PATH,
+                              XAPP_KBD_LAYOUT_DBUS_INTERFACE,
+                              NULL,
+                              proxy_ready,
+                              task);
+}
+
+/* Returns: (transfer full): the proxy, or NULL to work in-process */
+GDBusProxy *
+_xapp_kbd_layout_dbus_proxy_new_finish (GAsyncResult *result)
+{
+    return g_task_propagate_pointer (G_TASK (result), NULL);
+}
+
+/* Same layout as the image-data hint of desktop notifications.  An
+ * empty image (0 x 0) means there's no flag.
+ */
+GVariant *
+_xapp_kbd_layout_dbus_pixbuf_to_variant (GdkPixbuf *pixbuf)
+{
+    gint width, height, rowstride, n_channels, bits;
+    gsize length;
+
+    if (pixbuf == NULL)
+    {
+        return g_variant_new ("(iiibii@ay)",
+                              0, 0, 0, TRUE, 8, 4,
+                              g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, NULL, 0, 1));
+    }
+
+    width = gdk_pixbuf_get_width (pixbuf);
+    height = gdk_pixbuf_get_height (pixbuf);
+    rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+    n_channels = gdk_pixbuf_get_n_channels (pixbuf);
+    bits = gdk_pixbuf_get_bits_per_sample (pixbuf);
+
+    /* The last row isn't necessarily padded to the full rowstride */
+    length = (gsize) (height - 1) * rowstride + width * ((n_channels * bits + 7) / 8);
+
+    return g_variant_new ("(iiibii@ay)",
+                          width, height, rowstride,
+                          gdk_pixbuf_get_has_alpha (pixbuf),
+                          bits, n_channels,
+                          g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+                                                     gdk_pixbuf_get_pixels (pixbuf),
+                                                     length, 1));
+}
+
+GdkPixbuf *
+_xapp_kbd_layout_dbus_pixbuf_from_variant (GVariant *variant)
+{
+    gint width, height, rowstride, n_channels, bits;
+    gboolean has_alpha;
+    GVariant *data_variant;
+    const guchar *data;
+    gsize length;
+    GdkPixbuf *pixbuf = NULL;
+
+    g_variant_get (variant, "(iiibii@ay)",
+                   &width, &height, &rowstride,
+                   &has_alpha, &bits, &n_channels,
+                   &data_variant);
+
+    data = g_variant_get_fixed_array (data_variant, &length, 1);
+
+    if (width > 0 && height > 0 &&
+        bits == 8 && n_channels == (has_alpha ? 4 : 3) &&
+        rowstride >= width * n_channels &&
+        length >= (gsize) (height - 1) * rowstride + width * n_channels)
+    {
+        pixbuf = gdk_pixbuf_new_from_data (g_memdup (data, length),
+                                           GDK_COLORSPACE_RGB,
+                                           has_alpha,
+                                           bits,
+                                           width,
+                                           height,
+                                           rowstride,
+                                           (GdkPixbufDestroyNotify) g_free,
+                                           NULL);
+    }
+
+    g_variant_unref (data_variant);
+
+    return pixbuf;
+}
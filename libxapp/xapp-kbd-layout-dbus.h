@@ -0,0 +1,30 @@
+#ifndef __XAPP_KBD_LAYOUT_DBUS_H__
+#define __XAPP_KBD_LAYOUT_DBUS_H__
+
+#include <gio/gio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+#define XAPP_KBD_LAYOUT_DBUS_NAME      "org.x.KbdLayoutController"
+#define XAPP_KBD_LAYOUT_DBUS_PATH      "/org/x/KbdLayoutController"
+#define XAPP_KBD_LAYOUT_DBUS_INTERFACE "org.x.KbdLayoutController"
+
+/* Set to make controllers skip the session service and always run
+ * in-process - the service itself sets it for its own controller.
+ */
+#define XAPP_KBD_LAYOUT_LOCAL_ENV      "XAPP_KBD_LAYOUT_CONTROLLER_LOCAL"
+
+GDBusInterfaceInfo *_xapp_kbd_layout_dbus_get_interface_info (void);
+
+GDBusProxy         *_xapp_kbd_layout_dbus_proxy_new          (void);
+void                _xapp_kbd_layout_dbus_proxy_new_async    (GAsyncReadyCallback callback,
+                                                              gpointer            user_data);
+GDBusProxy         *_xapp_kbd_layout_dbus_proxy_new_finish   (GAsyncResult       *result);
+
+GVariant           *_xapp_kbd_layout_dbus_pixbuf_to_variant  (GdkPixbuf *pixbuf);
+GdkPixbuf          *_xapp_kbd_layout_dbus_pixbuf_from_variant (GVariant  *variant);
+
+G_END_DECLS
+
+#endif  /* __XAPP_KBD_LAYOUT_DBUS_H__ */
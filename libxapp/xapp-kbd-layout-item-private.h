@@ -0,0 +1,21 @@
+#ifndef __XAPP_KBD_LAYOUT_ITEM_PRIVATE_H__
+#define __XAPP_KBD_LAYOUT_ITEM_PRIVATE_H__
+
+#include "xapp-kbd-layout-controller.h"
+#include "xapp-kbd-layout-item.h"
+
+G_BEGIN_DECLS
+
+XAppKbdLayoutItem *_xapp_kbd_layout_item_new        (guint               group,
+                                                     const gchar        *name,
+                                                     const gchar        *short_name,
+                                                     XAppKbdLayoutState *state,
+                                                     gboolean            active);
+void               _xapp_kbd_layout_item_set_active (XAppKbdLayoutItem  *item,
+                                                     gboolean            active);
+void               _xapp_kbd_layout_item_set_state  (XAppKbdLayoutItem  *item,
+                                                     XAppKbdLayoutState *state);
+
+G_END_DECLS
+
+#endif  /* __XAPP_KBD_LAYOUT_ITEM_PRIVATE_H__ */
@@ -0,0 +1,324 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gio/gio.h>
+
+#include "xapp-kbd-layout-controller.h"
+#include "xapp-kbd-layout-item.h"
+#include "xapp-kbd-layout-item-private.h"
+
+enum
+{
+  PROP_0,
+
+  PROP_GROUP,
+  PROP_NAME,
+  PROP_SHORT_NAME,
+  PROP_ICON,
+  PROP_ACTIVE,
+};
+
+struct _XAppKbdLayoutItemPrivate
+{
+    guint group;
+    gchar *name;
+    gchar *short_name;
+    GIcon *icon;
+    gboolean active;
+
+    /* Renders the icon when it's first asked for, if it wasn't given */
+    XAppKbdLayoutState *state;
+};
+
+G_DEFINE_TYPE (XAppKbdLayoutItem, xapp_kbd_layout_item, G_TYPE_OBJECT);
+
+static void
+xapp_kbd_layout_item_init (XAppKbdLayoutItem *item)
+{
+    item->priv = G_TYPE_INSTANCE_GET_PRIVATE (item, XAPP_TYPE_KBD_LAYOUT_ITEM, XAppKbdLayoutItemPrivate);
+
+    XAppKbdLayoutItemPrivate *priv = item->priv;
+
+    priv->group = 0;
+    priv->name = NULL;
+    priv->short_name = NULL;
+    priv->icon = NULL;
+    priv->active = FALSE;
+    priv->state = NULL;
+}
+
+static void
+xapp_kbd_layout_item_set_property (GObject      *gobject,
+                                   guint         prop_id,
+                                   const GValue *value,
+                                   GParamSpec   *pspec)
+{
+    XAppKbdLayoutItem *item = XAPP_KBD_LAYOUT_ITEM (gobject);
+    XAppKbdLayoutItemPrivate *priv = item->priv;
+
+    switch (prop_id)
+    {
+        case PROP_GROUP:
+            priv->group = g_value_get_uint (value);
+            break;
+        case PROP_NAME:
+            priv->name = g_value_dup_string (value);
+            break;
+        case PROP_SHORT_NAME:
+            priv->short_name = g_value_dup_string (value);
+            break;
+        case PROP_ICON:
+            priv->icon = g_value_dup_object (value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (gobject, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+xapp_kbd_layout_item_get_property (GObject    *gobject,
+                                   guint       prop_id,
+                                   GValue     *value,
+                                   GParamSpec *pspec)
+{
+    XAppKbdLayoutItem *item = XAPP_KBD_LAYOUT_ITEM (gobject);
+    XAppKbdLayoutItemPrivate *priv = item->priv;
+
+    switch (prop_id)
+    {
+        case PROP_GROUP:
+            g_value_set_uint (value, priv->group);
+            break;
+        case PROP_NAME:
+            g_value_set_string (value, priv->name);
+            break;
+        case PROP_SHORT_NAME:
+            g_value_set_string (value, priv->short_name);
+            break;
+        case PROP_ICON:
+            g_value_set_object (value, xapp_kbd_layout_item_get_icon (item));
+            break;
+        case PROP_ACTIVE:
+            g_value_set_boolean (value, priv->active);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (gobject, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+xapp_kbd_layout_item_dispose (GObject *object)
+{
+    XAppKbdLayoutItem *item = XAPP_KBD_LAYOUT_ITEM (object);
+
+    g_clear_object (&item->priv->icon);
+    g_clear_pointer (&item->priv->state, xapp_kbd_layout_state_unref);
+
+    G_OBJECT_CLASS (xapp_kbd_layout_item_parent_class)->dispose (object);
+}
+
+static void
+xapp_kbd_layout_item_finalize (GObject *object)
+{
+    XAppKbdLayoutItem *item = XAPP_KBD_LAYOUT_ITEM (object);
+    XAppKbdLayoutItemPrivate *priv = item->priv;
+
+    g_clear_pointer (&priv->name, g_free);
+    g_clear_pointer (&priv->short_name, g_free);
+
+    G_OBJECT_CLASS (xapp_kbd_layout_item_parent_class)->finalize (object);
+}
+
+static void
+xapp_kbd_layout_item_class_init (XAppKbdLayoutItemClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+    gobject_class->dispose = xapp_kbd_layout_item_dispose;
+    gobject_class->finalize = xapp_kbd_layout_item_finalize;
+    gobject_class->set_property = xapp_kbd_layout_item_set_property;
+    gobject_class->get_property = xapp_kbd_layout_item_get_property;
+
+    g_type_class_add_private (gobject_class, sizeof (XAppKbdLayoutItemPrivate));
+
+    g_object_class_install_property (gobject_class, PROP_GROUP,
+                                     g_param_spec_uint ("group",
+                                                        "Group",
+                                                        "The index of the layout",
+                                                        0, G_MAXUINT, 0,
+                                                        G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY)
+                                    );
+
+    g_object_class_install_property (gobject_class, PROP_NAME,
+                                     g_param_spec_string ("name",
+                                                          "Name",
+                                                          "The full name of the layout",
+                                                          NULL,
+                                                          G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY)
+                                    );
+
+    g_object_class_install_property (gobject_class, PROP_SHORT_NAME,
+                                     g_param_spec_string ("short-name",
+                                                          "Short name",
+                                                          "The short name (and subscript, if any) of the layout",
+                                                          NULL,
+                                                          G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY)
+                                    );
+
+    g_object_class_install_property (gobject_class, PROP_ICON,
+                                     g_param_spec_object ("icon",
+                                                          "Icon",
+                                                          "The flag of the layout",
+                                                          G_TYPE_ICON,
+                                                          G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY)
+                                    );
+
+    g_object_class_install_property (gobject_class, PROP_ACTIVE,
+                                     g_param_spec_boolean ("active",
+                                                           "Active",
+                                                           "Whether this is the current layout",
+                                                           FALSE,
+                                                           G_PARAM_READABLE)
+                                    );
+}
+
+/* The icon comes from @state, and is only rendered when it's first
+ * asked for - most items in a model are never shown with their flag.
+ */
+XAppKbdLayoutItem *
+_xapp_kbd_layout_item_new (guint               group,
+                           const gchar        *name,
+                           const gchar        *short_name,
+                           XAppKbdLayoutState *state,
+                           gboolean            active)
+{
+    XAppKbdLayoutItem *item;
+
+    item = g_object_new (XAPP_TYPE_KBD_LAYOUT_ITEM,
+                         "group", group,
+                         "name", name,
+                         "short-name", short_name,
+                         NULL);
+
+    item->priv->state = xapp_kbd_layout_state_ref (state);
+    item->priv->active = active;
+
+    return item;
+}
+
+void
+_xapp_kbd_layout_item_set_active (XAppKbdLayoutItem *item,
+                                  gboolean           active)
+{
+    if (item->priv->active == active)
+    {
+        return;
+    }
+
+    item->priv->active = active;
+
+    g_object_notify (G_OBJECT (item), "active");
+}
+
+/* Moves an item that survived a reload over to the new snapshot, so its
+ * flag comes from (and is rendered into) the current store, and the old
+ * one can go.
+ */
+void
+_xapp_kbd_layout_item_set_state (XAppKbdLayoutItem  *item,
+                                 XAppKbdLayoutState *state)
+{
+    XAppKbdLayoutState *old = item->priv->state;
+
+    item->priv->state = xapp_kbd_layout_state_ref (state);
+
+    if (old != NULL)
+    {
+        xapp_kbd_layout_state_unref (old);
+    }
+}
+
+/**
+ * xapp_kbd_layout_item_get_group:
+ *
+ * Returns the index of the layout this item represents.
+ */
+guint
+xapp_kbd_layout_item_get_group (XAppKbdLayoutItem *item)
+{
+    g_return_val_if_fail (XAPP_IS_KBD_LAYOUT_ITEM (item), 0);
+
+    return item->priv->group;
+}
+
+/**
+ * xapp_kbd_layout_item_get_name:
+ *
+ * Returns the full name of the layout.
+ *
+ * Returns: (transfer none): the name.
+ */
+const gchar *
+xapp_kbd_layout_item_get_name (XAppKbdLayoutItem *item)
+{
+    g_return_val_if_fail (XAPP_IS_KBD_LAYOUT_ITEM (item), NULL);
+
+    return item->priv->name;
+}
+
+/**
+ * xapp_kbd_layout_item_get_short_name:
+ *
+ * Returns the short name (and subscript, if any) of the layout.
+ *
+ * Returns: (transfer none): the short name.
+ */
+const gchar *
+xapp_kbd_layout_item_get_short_name (XAppKbdLayoutItem *item)
+{
+    g_return_val_if_fail (XAPP_IS_KBD_LAYOUT_ITEM (item), NULL);
+
+    return item->priv->short_name;
+}
+
+/**
+ * xapp_kbd_layout_item_get_icon:
+ *
+ * Returns the in-memory flag icon of the layout.  The flag is rendered
+ * the first time it's asked for.
+ *
+ * Returns: (transfer none): a #GIcon, or NULL if there is no flag
+ * for the layout.
+ */
+GIcon *
+xapp_kbd_layout_item_get_icon (XAppKbdLayoutItem *item)
+{
+    g_return_val_if_fail (XAPP_IS_KBD_LAYOUT_ITEM (item), NULL);
+
+    XAppKbdLayoutItemPrivate *priv = item->priv;
+
+    if (priv->icon == NULL && priv->state != NULL)
+    {
+        return xapp_kbd_layout_state_peek_icon (priv->state, priv->group);
+    }
+
+    return priv->icon;
+}
+
+/**
+ * xapp_kbd_layout_item_get_active:
+ *
+ * Returns whether this is the current layout.
+ */
+gboolean
+xapp_kbd_layout_item_get_active (XAppKbdLayoutItem *item)
+{
+    g_return_val_if_fail (XAPP_IS_KBD_LAYOUT_ITEM (item), FALSE);
+
+    return item->priv->active;
+}
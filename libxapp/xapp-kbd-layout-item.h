@@ -0,0 +1,43 @@
+#ifndef __XAPP_KBD_LAYOUT_ITEM_H__
+#define __XAPP_KBD_LAYOUT_ITEM_H__
+
+#include <stdio.h>
+#include <gio/gio.h>
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define XAPP_TYPE_KBD_LAYOUT_ITEM            (xapp_kbd_layout_item_get_type ())
+#define XAPP_KBD_LAYOUT_ITEM(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), XAPP_TYPE_KBD_LAYOUT_ITEM, XAppKbdLayoutItem))
+#define XAPP_KBD_LAYOUT_ITEM_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  XAPP_TYPE_KBD_LAYOUT_ITEM, XAppKbdLayoutItemClass))
+#define XAPP_IS_KBD_LAYOUT_ITEM(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), XAPP_TYPE_KBD_LAYOUT_ITEM))
+#define XAPP_IS_KBD_LAYOUT_ITEM_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  XAPP_TYPE_KBD_LAYOUT_ITEM))
+#define XAPP_KBD_LAYOUT_ITEM_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  XAPP_TYPE_KBD_LAYOUT_ITEM, XAppKbdLayoutItemClass))
+
+typedef struct _XAppKbdLayoutItemPrivate XAppKbdLayoutItemPrivate;
+typedef struct _XAppKbdLayoutItem XAppKbdLayoutItem;
+typedef struct _XAppKbdLayoutItemClass XAppKbdLayoutItemClass;
+
+struct _XAppKbdLayoutItem
+{
+    GObject parent_object;
+
+    XAppKbdLayoutItemPrivate *priv;
+};
+
+struct _XAppKbdLayoutItemClass
+{
+    GObjectClass parent_class;
+};
+
+GType        xapp_kbd_layout_item_get_type       (void);
+guint        xapp_kbd_layout_item_get_group      (XAppKbdLayoutItem *item);
+const gchar *xapp_kbd_layout_item_get_name       (XAppKbdLayoutItem *item);
+const gchar *xapp_kbd_layout_item_get_short_name (XAppKbdLayoutItem *item);
+GIcon       *xapp_kbd_layout_item_get_icon       (XAppKbdLayoutItem *item);
+gboolean     xapp_kbd_layout_item_get_active     (XAppKbdLayoutItem *item);
+
+G_END_DECLS
+
+#endif  /* __XAPP_KBD_LAYOUT_ITEM_H__ */
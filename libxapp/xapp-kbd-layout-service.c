@@ -0,0 +1,328 @@
+#include <config.h>
+
+#include <stdlib.h>
+
+#include <gtk/gtk.h>
+
+#include <libgnomekbd/gkbd-configuration.h>
+
+#include "xapp-kbd-layout-controller.h"
+#include "xapp-kbd-layout-dbus.h"
+
+/* Session-wide keyboard layout service.  It owns the only in-process
+ * XAppKbdLayoutController of the session, and every other controller
+ * becomes a thin proxy for it - so gkbd is only listened to, and flags
+ * only rendered, once.
+ *
+ * Started on demand through D-Bus activation, or by hand for testing:
+ *
+ *     dbus-run-session -- sh -c "xapp-kbd-layout-service & sleep 1; test-scripts/xapp-kbd-layout-controller"
+ */
+
+typedef struct
+{
+    XAppKbdLayoutController *controller;
+    GkbdConfiguration *config;
+    GDBusConnection *connection;
+    guint registration_id;
+
+    gchar **group_names;
+    gchar **full_names;
+} Service;
+
+static void
+read_names (Service *service)
+{
+    gint i, n;
+
+    g_strfreev (service->group_names);
+    g_strfreev (service->full_names);
+
+    service->full_names = g_strdupv (gkbd_configuration_get_group_names (service->config));
+
+    n = g_strv_length (service->full_names);
+    service->group_names = g_new0 (gchar *, n + 1);
+
+    for (i = 0; i < n; i++)
+    {
+        service->group_names[i] = gkbd_configuration_get_group_name (service->config, i);
+    }
+}
+
+static guint
+get_current_group (Service *service)
+{
+    guint group;
+
+    g_object_get (service->controller, "current-group", &group, NULL);
+
+    return group;
+}
+
+static void
+emit_properties_changed (Service  *service,
+                         gboolean  groups_changed)
+{
+    GVariantBuilder builder;
+
+    if (service->connection == NULL)
+    {
+        return;
+    }
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+
+    if (groups_changed)
+    {
+        g_variant_builder_add (&builder, "{sv}", "GroupNames",
+                               g_variant_new_strv ((const gchar * const *) service->group_names, -1));
+        g_variant_builder_add (&builder, "{sv}", "FullNames",
+                               g_variant_new_strv ((const gchar * const *) service->full_names, -1));
+    }
+
+    g_variant_builder_add (&builder, "{sv}", "CurrentGroup",
+                           g_variant_new_uint32 (get_current_group (service)));
+
+    g_dbus_connection_emit_signal (service->connection,
+                                   NULL,
+                                   XAPP_KBD_LAYOUT_DBUS_PATH,
+                                   "org.freedesktop.DBus.Properties",
+                                   "PropertiesChanged",
+                                   g_variant_new ("(sa{sv}@as)",
+                                                  XAPP_KBD_LAYOUT_DBUS_INTERFACE,
+                                                  &builder,
+                                                  g_variant_new_strv (NULL, 0)),
+                                   NULL);
+}
+
+static void
+on_config_changed (XAppKbdLayoutController *controller,
+                   Service                 *service)
+{
+    read_names (service);
+
+    emit_properties_changed (service, TRUE);
+}
+
+static void
+on_layout_changed (XAppKbdLayoutController *controller,
+                   guint                    group,
+                   Service                 *service)
+{
+    if (service->connection != NULL)
+    {
+        g_dbus_connection_emit_signal (service->connection,
+                                       NULL,
+                                       XAPP_KBD_LAYOUT_DBUS_PATH,
+                                       XAPP_KBD_LAYOUT_DBUS_INTERFACE,
+                                       "LayoutChanged",
+                                       g_variant_new ("(u)", group),
+                                       NULL);
+    }
+
+    emit_properties_changed (service, FALSE);
+}
+
+static void
+handle_get_icon (Service               *service,
+                 GVariant              *parameters,
+                 GDBusMethodInvocation *invocation)
+{
+    XAppKbdLayoutState *state;
+    GIcon *icon;
+    guint group;
+
+    g_variant_get (parameters, "(u)", &group);
+
+    state = xapp_kbd_layout_controller_get_state (service->controller);
+
+    if (group >= xapp_kbd_layout_state_get_num_groups (state))
+    {
+        g_dbus_method_invocation_return_error (invocation,
+                                               G_DBUS_ERROR,
+                                               G_DBUS_ERROR_INVALID_ARGS,
+                                               "No such group: %u", group);
+        xapp_kbd_layout_state_unref (state);
+        return;
+    }
+
+    icon = xapp_kbd_layout_state_peek_icon (state, group);
+
+    g_dbus_method_invocation_return_value (invocation,
+                                           g_variant_new ("(ss@(iiibiiay))",
+                                                          xapp_kbd_layout_state_peek_name (state, group),
+                                                          xapp_kbd_layout_state_peek_short_name (state, group),
+                                                          _xapp_kbd_layout_dbus_pixbuf_to_variant (GDK_IS_PIXBUF (icon) ? GDK_PIXBUF (icon) : NULL)));
+
+    xapp_kbd_layout_state_unref (state);
+}
+
+static void
+handle_method_call (GDBusConnection       *connection,
+                    const gchar           *sender,
+                    const gchar           *object_path,
+                    const gchar           *interface_name,
+                    const gchar           *method_name,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data)
+{
+    Service *service = user_data;
+    gboolean enabled = xapp_kbd_layout_controller_get_enabled (service->controller);
+
+    if (g_strcmp0 (method_name, "GetIcon") == 0)
+    {
+        handle_get_icon (service, parameters, invocation);
+        return;
+    }
+
+    if (g_strcmp0 (method_name, "SetCurrentGroup") == 0)
+    {
+        XAppKbdLayoutState *state = xapp_kbd_layout_controller_get_state (service->controller);
+        guint group;
+
+        g_variant_get (parameters, "(u)", &group);
+
+        if (enabled && group < xapp_kbd_layout_state_get_num_groups (state))
+        {
+            xapp_kbd_layout_controller_set_current_group (service->controller, group);
+        }
+
+        xapp_kbd_layout_state_unref (state);
+    }
+    else if (g_strcmp0 (method_name, "NextGroup") == 0)
+    {
+        if (enabled)
+        {
+            xapp_kbd_layout_controller_next_group (service->controller);
+        }
+    }
+    else if (g_strcmp0 (method_name, "PreviousGroup") == 0)
+    {
+        if (enabled)
+        {
+            xapp_kbd_layout_controller_previous_group (service->controller);
+        }
+    }
+
+    g_dbus_method_invocation_return_value (invocation, NULL);
+}
+
+static GVariant *
+handle_get_property (GDBusConnection  *connection,
+                     const gchar      *sender,
+                     const gchar      *object_path,
+                     const gchar      *interface_name,
+                     const gchar      *property_name,
+                     GError          **error,
+                     gpointer          user_data)
+{
+    Service *service = user_data;
+
+    if (g_strcmp0 (property_name, "GroupNames") == 0)
+    {
+        return g_variant_new_strv ((const gchar * const *) service->group_names, -1);
+    }
+
+    if (g_strcmp0 (property_name, "FullNames") == 0)
+    {
+        return g_variant_new_strv ((const gchar * const *) service->full_names, -1);
+    }
+
+    if (g_strcmp0 (property_name, "CurrentGroup") == 0)
+    {
+        return g_variant_new_uint32 (get_current_group (service));
+    }
+
+    return NULL;
+}
+
+static const GDBusInterfaceVTable interface_vtable =
+{
+    handle_method_call,
+    handle_get_property,
+    NULL
+};
+
+static void
+on_bus_acquired (GDBusConnection *connection,
+                 const gchar     *name,
+                 gpointer         user_data)
+{
+    Service *service = user_data;
+    GError *error = NULL;
+
+    service->registration_id = g_dbus_connection_register_object (connection,
+                                                                  XAPP_KBD_LAYOUT_DBUS_PATH,
+                                                                  _xapp_kbd_layout_dbus_get_interface_info (),
+                                                                  &interface_vtable,
+                                                                  service,
+                                                                  NULL,
+                                                                  &error);
+
+    if (service->registration_id == 0)
+    {
+        g_critical ("Could not export the keyboard layout service: %s", error->message);
+        g_error_free (error);
+        gtk_main_quit ();
+        return;
+    }
+
+    service->connection = g_object_ref (connection);
+}
+
+static void
+on_name_lost (GDBusConnection *connection,
+              const gchar     *name,
+              gpointer         user_data)
+{
+    /* Either another instance got there first, or the session is ending */
+    gtk_main_quit ();
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+    Service service = { 0 };
+    guint owner_id;
+
+    /* Our controller is the one doing the actual work */
+    g_setenv (XAPP_KBD_LAYOUT_LOCAL_ENV, "1", TRUE);
+
+    gtk_init (&argc, &argv);
+
+    service.config = gkbd_configuration_get ();
+    service.controller = xapp_kbd_layout_controller_new ();
+
+    read_names (&service);
+
+    g_signal_connect (service.controller, "config-changed", G_CALLBACK (on_config_changed), &service);
+    g_signal_connect (service.controller, "layout-changed", G_CALLBACK (on_layout_changed), &service);
+
+    owner_id = g_bus_own_name (G_BUS_TYPE_SESSION,
+                               XAPP_KBD_LAYOUT_DBUS_NAME,
+                               G_BUS_NAME_OWNER_FLAGS_NONE,
+                               on_bus_acquired,
+                               NULL,
+                               on_name_lost,
+                               &service,
+                               NULL);
+
+    gtk_main ();
+
+    g_bus_unown_name (owner_id);
+
+    if (service.registration_id != 0)
+    {
+        g_dbus_connection_unregister_object (service.connection, service.registration_id);
+    }
+
+    g_clear_object (&service.connection);
+    g_clear_object (&service.controller);
+    g_clear_object (&service.config);
+    g_strfreev (service.group_names);
+    g_strfreev (service.full_names);
+
+    return EXIT_SUCCESS;
+}
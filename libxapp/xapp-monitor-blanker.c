@@ -8,29 +8,116 @@
 #include <gdk/gdkx.h>
 #include <gtk/gtk.h>
 
+#include <X11/Xatom.h>
+
 #include <glib/gi18n-lib.h>
 
 #include "xapp-monitor-blanker.h"
+#include "xapp-trace-private.h"
+
+/* Frames to wait for the compositor to report when the first one was
+ * presented, before settling for when it was painted.
+ */
+#define MAX_PRESENTATION_WAIT 4
 
 struct _XAppMonitorBlankerPrivate
 {
-    int num_outputs;
     gboolean blanked;
-    GtkWidget **windows;
+
+    /* GdkMonitor -> blanking window.  Unblanking only hides them, they're
+     * kept until their monitor goes away, they're released or the blanker
+     * is finalized.
+     */
+    GHashTable *windows;
+
+    /* Single window mode - one window covering all the monitors, shaped
+     * to the ones being blanked, pooled the same way.
+     */
+    gboolean single_window;
+    GtkWidget *shaped_window;
+
+    /* Zero-paint mode, and the mode the pooled windows were created in */
+    gboolean zero_paint;
+    gboolean pool_zero_paint;
+
+    /* The display we're tracking monitor changes on, from the first blank */
+    GdkDisplay *display;
+
+    /* Only set while blanked */
+    gboolean use_shape;
+    GtkWindow *active_window;
+    GdkMonitor *active_monitor;
+
+    /* Windows we're waiting on to be painted (blanking) or unmapped
+     * (unblanking) before emitting blanked or unblanked.
+     */
+    GPtrArray *pending;
+    GPtrArray *pending_clocks;
+    gboolean pending_blank;
+    gint64 request_time;
+
+    /* When the last blanking window's first frame reached the screen */
+    gint64 presented_time;
+};
+
+/* A frame clock of windows being blanked, and its first frame */
+typedef struct
+{
+    GdkFrameClock *clock;
+    GdkFrameTimings *timings;
+    gint64 painted_time;
+    guint frames_waited;
+} PendingClock;
+
+enum
+{
+    BLANKED,
+    UNBLANKED,
+    LAST_SIGNAL
 };
 
+static guint signals[LAST_SIGNAL] = {0, };
+
 G_DEFINE_TYPE (XAppMonitorBlanker, xapp_monitor_blanker, G_TYPE_OBJECT);
 
-GtkWidget *create_blanking_window (GdkScreen *screen,
-                                   int        monitor);
+/* Shared by every blanking window, parsed once */
+static GtkCssProvider *blanking_css_provider = NULL;
+
+GtkWidget *create_blanking_window (GdkDisplay *display,
+                                   gboolean    zero_paint);
+
+static void disconnect_display (XAppMonitorBlanker *self);
+
+static void
+pending_clock_free (PendingClock *pending)
+{
+    g_object_unref (pending->clock);
+    g_clear_pointer (&pending->timings, gdk_frame_timings_unref);
+
+    g_slice_free (PendingClock, pending);
+}
 
 static void
 xapp_monitor_blanker_init (XAppMonitorBlanker *self)
 {
     self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, XAPP_TYPE_MONITOR_BLANKER, XAppMonitorBlankerPrivate);
-    self->priv->num_outputs = 0;
     self->priv->blanked = FALSE;
-    self->priv->windows = NULL;
+    self->priv->windows = g_hash_table_new_full (NULL, NULL,
+                                                 (GDestroyNotify) g_object_unref,
+                                                 (GDestroyNotify) gtk_widget_destroy);
+    self->priv->single_window = FALSE;
+    self->priv->shaped_window = NULL;
+    self->priv->zero_paint = FALSE;
+    self->priv->pool_zero_paint = FALSE;
+    self->priv->display = NULL;
+    self->priv->use_shape = FALSE;
+    self->priv->active_window = NULL;
+    self->priv->active_monitor = NULL;
+    self->priv->pending = g_ptr_array_new ();
+    self->priv->pending_clocks = g_ptr_array_new_with_free_func ((GDestroyNotify) pending_clock_free);
+    self->priv->pending_blank = FALSE;
+    self->priv->request_time = 0;
+    self->priv->presented_time = 0;
 }
 
 static void
@@ -38,11 +125,12 @@ xapp_monitor_blanker_finalize (GObject *object)
 {
     XAppMonitorBlanker *self = XAPP_MONITOR_BLANKER (object);
 
-    if (self->priv->windows != NULL)
-    {
-        xapp_monitor_blanker_unblank_monitors (XAPP_MONITOR_BLANKER(self));
-        g_free (self->priv->windows);
-    }
+    xapp_monitor_blanker_release_windows (self);
+    disconnect_display (self);
+
+    g_hash_table_unref (self->priv->windows);
+    g_ptr_array_unref (self->priv->pending);
+    g_ptr_array_unref (self->priv->pending_clocks);
 
     G_OBJECT_CLASS (xapp_monitor_blanker_parent_class)->finalize (object);
 }
@@ -52,9 +140,53 @@ xapp_monitor_blanker_class_init (XAppMonitorBlankerClass *klass)
 {
     GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
 
+    _xapp_trace_init ();
+
     gobject_class->finalize = xapp_monitor_blanker_finalize;
 
     g_type_class_add_private (gobject_class, sizeof (XAppMonitorBlankerPrivate));
+
+    /**
+     * XAppMonitorBlanker::blanked:
+     * @blanker: the #XAppMonitorBlanker
+     * @latency: the time, in microseconds, from the blank request to the
+     * first frame being presented on every blanked monitor
+     *
+     * Emitted once every monitor other than the active one is covered.
+     * Where the compositor reports presentation times, that's when the
+     * frames actually reached the screen, otherwise when they were
+     * painted, which is earlier by up to a frame or two.
+     */
+    signals[BLANKED] = g_signal_new ("blanked",
+                                     G_TYPE_FROM_CLASS (gobject_class),
+                                     G_SIGNAL_RUN_LAST,
+                                     0,
+                                     NULL, NULL,
+                                     NULL,
+                                     G_TYPE_NONE,
+                                     1, G_TYPE_INT64);
+
+    /**
+     * XAppMonitorBlanker::unblanked:
+     * @blanker: the #XAppMonitorBlanker
+     * @latency: the time, in microseconds, from the unblank request to
+     * every blanking window being unmapped
+     *
+     * Emitted once every blanking window is gone from the screen.
+     */
+    signals[UNBLANKED] = g_signal_new ("unblanked",
+                                       G_TYPE_FROM_CLASS (gobject_class),
+                                       G_SIGNAL_RUN_LAST,
+                                       0,
+                                       NULL, NULL,
+                                       NULL,
+                                       G_TYPE_NONE,
+                                       1, G_TYPE_INT64);
+
+    blanking_css_provider = gtk_css_provider_new ();
+    gtk_css_provider_load_from_data (blanking_css_provider,
+                                     ".xapp-blanking-window { background-color: rgb(0, 0, 0); }",
+                                     -1, NULL);
 }
 
 XAppMonitorBlanker *
@@ -63,91 +195,858 @@ xapp_monitor_blanker_new (void)
     return g_object_new (XAPP_TYPE_MONITOR_BLANKER, NULL);
 }
 
+static gboolean
+on_zero_paint_draw (GtkWidget *widget,
+                    cairo_t   *cr,
+                    gpointer   user_data)
+{
+    /* The X server already filled the window with its background pixel */
+    return TRUE;
+}
+
+/* Lets the X server do all the painting - the window's background pixel
+ * is black, so exposes are filled server-side - and asks the compositor
+ * to unredirect it.
+ */
+static void
+on_zero_paint_realize (GtkWidget *widget,
+                       gpointer   user_data)
+{
+    GdkWindow *window = gtk_widget_get_window (widget);
+    GdkDisplay *display = gdk_window_get_display (window);
+    Display *xdisplay = GDK_DISPLAY_XDISPLAY (display);
+    Window xwindow = GDK_WINDOW_XID (window);
+    long bypass = 1;
+
+    XSetWindowBackground (xdisplay, xwindow, BlackPixel (xdisplay, DefaultScreen (xdisplay)));
+
+    XChangeProperty (xdisplay, xwindow,
+                     gdk_x11_get_xatom_by_name_for_display (display, "_NET_WM_BYPASS_COMPOSITOR"),
+                     XA_CARDINAL, 32, PropModeReplace,
+                     (guchar *) &bypass, 1);
+}
+
 GtkWidget *
-create_blanking_window (GdkScreen *screen,
-                        int        monitor)
+create_blanking_window (GdkDisplay *display,
+                        gboolean    zero_paint)
 {
-    GdkRectangle fullscreen;
     GtkWidget *window;
     GtkStyleContext *context;
-    GtkCssProvider *provider;
-
-    gdk_screen_get_monitor_geometry(screen, monitor, &fullscreen);
 
     window = gtk_window_new (GTK_WINDOW_POPUP);
+    gtk_window_set_screen (GTK_WINDOW (window), gdk_display_get_default_screen (display));
     gtk_window_set_skip_taskbar_hint (GTK_WINDOW (window), TRUE);
     gtk_window_set_skip_pager_hint (GTK_WINDOW (window), TRUE);
-    gtk_window_resize (GTK_WINDOW (window), fullscreen.width, fullscreen.height);
-    gtk_window_move (GTK_WINDOW (window), fullscreen.x, fullscreen.y);
-    gtk_widget_set_visible (window, TRUE);
+
+    if (zero_paint && GDK_IS_X11_DISPLAY (display))
+    {
+        /* No style, and nothing drawn client-side.  Without double
+         * buffering, exposes don't go through a window-sized offscreen
+         * (that GDK would clear and copy over) either - draw gets a
+         * context on the window itself, and leaves it alone.
+         */
+        gtk_widget_set_app_paintable (window, TRUE);
+G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+        gtk_widget_set_double_buffered (window, FALSE);
+G_GNUC_END_IGNORE_DEPRECATIONS
+        g_signal_connect (window, "draw", G_CALLBACK (on_zero_paint_draw), NULL);
+        g_signal_connect_after (window, "realize", G_CALLBACK (on_zero_paint_realize), NULL);
+
+        return window;
+    }
 
     context = gtk_widget_get_style_context (GTK_WIDGET (window));
     gtk_style_context_add_class (context, "xapp-blanking-window");
-    provider = gtk_css_provider_new ();
-    gtk_css_provider_load_from_data (provider,
-                                     ".xapp-blanking-window { background-color: rgb(0, 0, 0); }",
-                                     -1, NULL);
-    gtk_style_context_add_provider (context, GTK_STYLE_PROVIDER (provider), GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
+    gtk_style_context_add_provider (context, GTK_STYLE_PROVIDER (blanking_css_provider), GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
 
     return window;
 }
 
+static void
+place_blanking_window (GtkWidget  *window,
+                       GdkMonitor *monitor)
+{
+    GdkRectangle fullscreen;
+
+    gdk_monitor_get_geometry (monitor, &fullscreen);
+
+    gtk_window_resize (GTK_WINDOW (window), fullscreen.width, fullscreen.height);
+    gtk_window_move (GTK_WINDOW (window), fullscreen.x, fullscreen.y);
+}
+
+/* Covers the bounding box of all the monitors, clipped (both output and
+ * input) to the ones other than the active one.  Returns the window,
+ * ready to be shown, or NULL if there's nothing to blank.
+ */
+static GtkWidget *
+prepare_shaped_window (XAppMonitorBlanker *self)
+{
+    GdkDisplay *display = self->priv->display;
+    cairo_region_t *region;
+    GdkRectangle geometry, bounds = { 0, 0, 0, 0 };
+    int i, n;
+
+    region = cairo_region_create ();
+    n = gdk_display_get_n_monitors (display);
+
+    for (i = 0; i < n; i++)
+    {
+        GdkMonitor *monitor = gdk_display_get_monitor (display, i);
+
+        gdk_monitor_get_geometry (monitor, &geometry);
+
+        if (i == 0)
+        {
+            bounds = geometry;
+        }
+        else
+        {
+            gdk_rectangle_union (&bounds, &geometry, &bounds);
+        }
+
+        if (monitor != self->priv->active_monitor)
+        {
+            cairo_region_union_rectangle (region, &geometry);
+        }
+    }
+
+    /* Overlapping (cloned) monitors share pixels with the active one */
+    if (self->priv->active_monitor != NULL)
+    {
+        gdk_monitor_get_geometry (self->priv->active_monitor, &geometry);
+        cairo_region_subtract_rectangle (region, &geometry);
+    }
+
+    if (cairo_region_is_empty (region))
+    {
+        if (self->priv->shaped_window != NULL)
+        {
+            gtk_widget_hide (self->priv->shaped_window);
+        }
+
+        cairo_region_destroy (region);
+        return NULL;
+    }
+
+    if (self->priv->shaped_window == NULL)
+    {
+        self->priv->shaped_window = create_blanking_window (display, self->priv->zero_paint);
+    }
+
+    cairo_region_translate (region, -bounds.x, -bounds.y);
+
+    gtk_window_resize (GTK_WINDOW (self->priv->shaped_window), bounds.width, bounds.height);
+    gtk_window_move (GTK_WINDOW (self->priv->shaped_window), bounds.x, bounds.y);
+
+    gtk_widget_shape_combine_region (self->priv->shaped_window, region);
+    gtk_widget_input_shape_combine_region (self->priv->shaped_window, region);
+
+    gtk_widget_realize (self->priv->shaped_window);
+
+    cairo_region_destroy (region);
+
+    return self->priv->shaped_window;
+}
+
+static void
+update_shaped_window (XAppMonitorBlanker *self)
+{
+    GtkWidget *window = prepare_shaped_window (self);
+
+    if (window != NULL)
+    {
+        gtk_widget_show (window);
+    }
+}
+
+/* Creates (or reuses) and places the window for a single monitor,
+ * without showing it.  Returns NULL, hiding any pooled window, if the
+ * monitor is the active one.
+ */
+static GtkWidget *
+prepare_monitor (XAppMonitorBlanker *self,
+                 GdkMonitor         *monitor)
+{
+    GtkWidget *window = g_hash_table_lookup (self->priv->windows, monitor);
+
+    if (monitor == self->priv->active_monitor)
+    {
+        if (window != NULL)
+        {
+            gtk_widget_hide (window);
+        }
+
+        return NULL;
+    }
+
+    if (window == NULL)
+    {
+        window = create_blanking_window (self->priv->display, self->priv->zero_paint);
+        g_hash_table_insert (self->priv->windows, g_object_ref (monitor), window);
+    }
+
+    place_blanking_window (window, monitor);
+    gtk_widget_realize (window);
+
+    return window;
+}
+
+/* Brings the window for a single monitor in line with the current state */
+static void
+update_monitor (XAppMonitorBlanker *self,
+                GdkMonitor         *monitor)
+{
+    GtkWidget *window;
+
+    if (!self->priv->blanked)
+    {
+        return;
+    }
+
+    if (self->priv->use_shape)
+    {
+        update_shaped_window (self);
+        return;
+    }
+
+    window = prepare_monitor (self, monitor);
+
+    if (window != NULL)
+    {
+        gtk_widget_show (window);
+    }
+}
+
+static void
+finish_pending (XAppMonitorBlanker *self)
+{
+    guint i;
+
+    for (i = 0; i < self->priv->pending_clocks->len; i++)
+    {
+        PendingClock *pending = g_ptr_array_index (self->priv->pending_clocks, i);
+
+        g_signal_handlers_disconnect_by_data (pending->clock, self);
+    }
+
+    for (i = 0; i < self->priv->pending->len; i++)
+    {
+        g_signal_handlers_disconnect_by_data (g_ptr_array_index (self->priv->pending, i), self);
+    }
+
+    g_ptr_array_set_size (self->priv->pending_clocks, 0);
+    g_ptr_array_set_size (self->priv->pending, 0);
+}
+
+static void
+pending_window_done (XAppMonitorBlanker *self,
+                     GtkWidget          *window)
+{
+    gint64 end_time;
+
+    if (!g_ptr_array_remove_fast (self->priv->pending, window))
+    {
+        return;
+    }
+
+    g_signal_handlers_disconnect_by_data (window, self);
+
+    if (self->priv->pending->len > 0)
+    {
+        return;
+    }
+
+    finish_pending (self);
+
+    /* Windows destroyed before they were presented don't set it */
+    if (self->priv->pending_blank && self->priv->presented_time != 0)
+    {
+        end_time = self->priv->presented_time;
+    }
+    else
+    {
+        end_time = g_get_monotonic_time ();
+    }
+
+    g_signal_emit (self,
+                   signals[self->priv->pending_blank ? BLANKED : UNBLANKED],
+                   0,
+                   end_time - self->priv->request_time);
+}
+
+static void
+on_pending_window_destroy (GtkWidget          *window,
+                           XAppMonitorBlanker *self)
+{
+    pending_window_done (self, window);
+}
+
+static gboolean
+on_pending_window_unmap (GtkWidget          *window,
+                         GdkEvent           *event,
+                         XAppMonitorBlanker *self)
+{
+    pending_window_done (self, window);
+
+    return FALSE;
+}
+
+static PendingClock *
+find_pending_clock (XAppMonitorBlanker *self,
+                    GdkFrameClock      *clock)
+{
+    guint i;
+
+    for (i = 0; i < self->priv->pending_clocks->len; i++)
+    {
+        PendingClock *pending = g_ptr_array_index (self->priv->pending_clocks, i);
+
+        if (pending->clock == clock)
+        {
+            return pending;
+        }
+    }
+
+    return NULL;
+}
+
+/* Returns TRUE, with the time in presented_time, once the first frame's
+ * presentation is known - or it's given up on, and the paint time stands
+ * in for it.
+ */
+static gboolean
+get_presented_time (PendingClock *pending,
+                    gint64       *presented_time)
+{
+    if (pending->timings != NULL && gdk_frame_timings_get_complete (pending->timings))
+    {
+        /* Complete without one if the compositor doesn't report them */
+        *presented_time = gdk_frame_timings_get_presentation_time (pending->timings);
+
+        if (*presented_time != 0)
+        {
+            return TRUE;
+        }
+    }
+    else if (pending->timings != NULL && ++pending->frames_waited <= MAX_PRESENTATION_WAIT)
+    {
+        return FALSE;
+    }
+
+    *presented_time = pending->painted_time;
+
+    return TRUE;
+}
+
+static void
+on_after_paint (GdkFrameClock      *clock,
+                XAppMonitorBlanker *self)
+{
+    PendingClock *pending;
+    gint64 presented_time;
+    guint i = 0;
+
+    pending = find_pending_clock (self, clock);
+
+    if (pending == NULL)
+    {
+        return;
+    }
+
+    if (pending->painted_time == 0)
+    {
+        GdkFrameTimings *timings = gdk_frame_clock_get_current_timings (clock);
+
+        pending->timings = timings != NULL ? gdk_frame_timings_ref (timings) : NULL;
+        pending->painted_time = g_get_monotonic_time ();
+    }
+
+    /* The timings are filled in as the compositor reports back, which
+     * may take a frame or two - keep frames coming until then.
+     */
+    if (!get_presented_time (pending, &presented_time))
+    {
+        gdk_frame_clock_request_phase (clock, GDK_FRAME_CLOCK_PHASE_AFTER_PAINT);
+        return;
+    }
+
+    self->priv->presented_time = MAX (self->priv->presented_time, presented_time);
+
+    while (i < self->priv->pending->len)
+    {
+        GtkWidget *window = g_ptr_array_index (self->priv->pending, i);
+
+        /* Removing the last one emits blanked, and clears everything */
+        if (gtk_widget_get_frame_clock (window) == clock)
+        {
+            pending_window_done (self, window);
+            continue;
+        }
+
+        i++;
+    }
+}
+
+/* Maps all the prepared windows together, so they reach the server in
+ * one batch, and starts waiting for their first frame.
+ */
+static void
+map_windows (XAppMonitorBlanker *self,
+             GPtrArray          *windows)
+{
+    guint i;
+
+    self->priv->pending_blank = TRUE;
+    self->priv->presented_time = 0;
+
+    for (i = 0; i < windows->len; i++)
+    {
+        GtkWidget *window = g_ptr_array_index (windows, i);
+        GdkFrameClock *clock = gtk_widget_get_frame_clock (window);
+
+        g_ptr_array_add (self->priv->pending, window);
+        g_signal_connect (window, "destroy", G_CALLBACK (on_pending_window_destroy), self);
+
+        if (clock != NULL && find_pending_clock (self, clock) == NULL)
+        {
+            PendingClock *pending = g_slice_new0 (PendingClock);
+
+            pending->clock = g_object_ref (clock);
+
+            g_ptr_array_add (self->priv->pending_clocks, pending);
+            g_signal_connect (clock, "after-paint", G_CALLBACK (on_after_paint), self);
+        }
+    }
+
+    for (i = 0; i < windows->len; i++)
+    {
+        gtk_widget_show (g_ptr_array_index (windows, i));
+    }
+
+    gdk_display_flush (self->priv->display);
+
+    if (windows->len == 0)
+    {
+        g_signal_emit (self, signals[BLANKED], 0, g_get_monotonic_time () - self->priv->request_time);
+    }
+}
+
+/* Hides the given windows together, and starts waiting for them to be
+ * unmapped.
+ */
+static void
+unmap_windows (XAppMonitorBlanker *self,
+               GPtrArray          *windows)
+{
+    guint i;
+
+    self->priv->pending_blank = FALSE;
+
+    for (i = 0; i < windows->len; i++)
+    {
+        GtkWidget *window = g_ptr_array_index (windows, i);
+
+        g_ptr_array_add (self->priv->pending, window);
+        g_signal_connect (window, "destroy", G_CALLBACK (on_pending_window_destroy), self);
+        g_signal_connect (window, "unmap-event", G_CALLBACK (on_pending_window_unmap), self);
+    }
+
+    for (i = 0; i < windows->len; i++)
+    {
+        gtk_widget_hide (g_ptr_array_index (windows, i));
+    }
+
+    if (self->priv->display != NULL)
+    {
+        gdk_display_flush (self->priv->display);
+    }
+
+    if (windows->len == 0)
+    {
+        g_signal_emit (self, signals[UNBLANKED], 0, g_get_monotonic_time () - self->priv->request_time);
+    }
+}
+
+static void
+on_monitor_geometry_changed (GdkMonitor         *monitor,
+                             GParamSpec         *pspec,
+                             XAppMonitorBlanker *self)
+{
+    update_monitor (self, monitor);
+}
+
+static void
+on_monitor_added (GdkDisplay         *display,
+                  GdkMonitor         *monitor,
+                  XAppMonitorBlanker *self)
+{
+    g_signal_connect (monitor, "notify::geometry", G_CALLBACK (on_monitor_geometry_changed), self);
+
+    update_monitor (self, monitor);
+}
+
+static void
+on_monitor_removed (GdkDisplay         *display,
+                    GdkMonitor         *monitor,
+                    XAppMonitorBlanker *self)
+{
+    g_signal_handlers_disconnect_by_data (monitor, self);
+
+    if (monitor == self->priv->active_monitor)
+    {
+        /* Wait for the active window to be moved to another monitor */
+        self->priv->active_monitor = NULL;
+    }
+
+    g_hash_table_remove (self->priv->windows, monitor);
+
+    if (self->priv->blanked && self->priv->use_shape)
+    {
+        update_shaped_window (self);
+    }
+}
+
+static void
+connect_display (XAppMonitorBlanker *self,
+                 GdkDisplay         *display)
+{
+    int i, n;
+
+    if (self->priv->display == display)
+    {
+        return;
+    }
+
+    disconnect_display (self);
+    xapp_monitor_blanker_release_windows (self);
+
+    self->priv->display = g_object_ref (display);
+
+    g_signal_connect (display, "monitor-added", G_CALLBACK (on_monitor_added), self);
+    g_signal_connect (display, "monitor-removed", G_CALLBACK (on_monitor_removed), self);
+
+    n = gdk_display_get_n_monitors (display);
+
+    for (i = 0; i < n; i++)
+    {
+        g_signal_connect (gdk_display_get_monitor (display, i),
+                          "notify::geometry",
+                          G_CALLBACK (on_monitor_geometry_changed),
+                          self);
+    }
+}
+
+static void
+disconnect_display (XAppMonitorBlanker *self)
+{
+    int i, n;
+
+    if (self->priv->display == NULL)
+    {
+        return;
+    }
+
+    n = gdk_display_get_n_monitors (self->priv->display);
+
+    for (i = 0; i < n; i++)
+    {
+        g_signal_handlers_disconnect_by_data (gdk_display_get_monitor (self->priv->display, i), self);
+    }
+
+    g_signal_handlers_disconnect_by_data (self->priv->display, self);
+    g_clear_object (&self->priv->display);
+}
+
+static GdkMonitor *
+get_window_monitor (XAppMonitorBlanker *self,
+                    GtkWindow          *window)
+{
+    GdkWindow *gdk_window = gtk_widget_get_window (GTK_WIDGET (window));
+
+    if (gdk_window == NULL)
+    {
+        return self->priv->active_monitor;
+    }
+
+    return gdk_display_get_monitor_at_window (self->priv->display, gdk_window);
+}
+
+/* Follows the fullscreen window when it moves to another monitor */
+static gboolean
+on_active_window_configure (GtkWidget          *widget,
+                            GdkEvent           *event,
+                            XAppMonitorBlanker *self)
+{
+    GdkMonitor *old_monitor = self->priv->active_monitor;
+    GdkMonitor *new_monitor = get_window_monitor (self, GTK_WINDOW (widget));
+
+    if (new_monitor == old_monitor)
+    {
+        return FALSE;
+    }
+
+    self->priv->active_monitor = new_monitor;
+
+    if (self->priv->use_shape)
+    {
+        update_shaped_window (self);
+        return FALSE;
+    }
+
+    if (old_monitor != NULL)
+    {
+        update_monitor (self, old_monitor);
+    }
+
+    if (new_monitor != NULL)
+    {
+        update_monitor (self, new_monitor);
+    }
+
+    return FALSE;
+}
+
+static void
+track_active_window (XAppMonitorBlanker *self,
+                     GtkWindow          *window)
+{
+    self->priv->active_window = window;
+    g_object_add_weak_pointer (G_OBJECT (window), (gpointer *) &self->priv->active_window);
+
+    g_signal_connect (window, "configure-event", G_CALLBACK (on_active_window_configure), self);
+}
+
+static void
+untrack_active_window (XAppMonitorBlanker *self)
+{
+    if (self->priv->active_window != NULL)
+    {
+        g_signal_handlers_disconnect_by_data (self->priv->active_window, self);
+        g_object_remove_weak_pointer (G_OBJECT (self->priv->active_window), (gpointer *) &self->priv->active_window);
+        self->priv->active_window = NULL;
+    }
+
+    self->priv->active_monitor = NULL;
+}
+
 void
 xapp_monitor_blanker_blank_other_monitors (XAppMonitorBlanker *self,
                                    GtkWindow   *window)
 {
-    GdkScreen *screen;
-    int active_monitor;
-    int i;
+    GdkDisplay *display;
+    GPtrArray *windows;
+    GtkWidget *blanking_window;
+    gint64 trace_start;
+    int i, n;
 
     g_return_if_fail (XAPP_IS_MONITOR_BLANKER (self));
 
-    if (self->priv->windows != NULL)
+    if (self->priv->blanked)
         return;
 
-    screen = gtk_window_get_screen (window);
-    active_monitor = gdk_screen_get_monitor_at_window (screen, gtk_widget_get_window (GTK_WIDGET (window)));
-    self->priv->num_outputs = gdk_screen_get_n_monitors (screen);
-    self->priv->windows = g_new (GtkWidget *, self->priv->num_outputs);
+    /* Pooled windows from before the mode changed can't be reused */
+    if (self->priv->pool_zero_paint != self->priv->zero_paint)
+    {
+        xapp_monitor_blanker_release_windows (self);
+        self->priv->pool_zero_paint = self->priv->zero_paint;
+    }
+
+    /* A pending unblanked is superseded */
+    finish_pending (self);
+    self->priv->request_time = g_get_monotonic_time ();
+
+    display = gtk_widget_get_display (GTK_WIDGET (window));
+
+    connect_display (self, display);
+    track_active_window (self, window);
+
+    self->priv->active_monitor = get_window_monitor (self, window);
+    self->priv->blanked = TRUE;
+
+    /* Without shape support, the per-monitor windows are the fallback */
+    self->priv->use_shape = self->priv->single_window && gdk_display_supports_shapes (display);
+
+    /* Get every window created, placed and realized first, then map
+     * them all at once so the monitors go black in the same frame.
+     */
+    windows = g_ptr_array_new ();
+    trace_start = _xapp_trace_span_begin ();
 
-    for (i = 0; i < self->priv->num_outputs; i++)
+    if (self->priv->use_shape)
     {
-        if (i != active_monitor)
+        blanking_window = prepare_shaped_window (self);
+
+        if (blanking_window != NULL)
         {
-            self->priv->windows[i] = create_blanking_window (screen, i);
+            g_ptr_array_add (windows, blanking_window);
         }
-        else
+    }
+    else
+    {
+        /* The monitor layout may have changed since the windows were pooled */
+        n = gdk_display_get_n_monitors (display);
+
+        for (i = 0; i < n; i++)
         {
-            // initialize at NULL so it gets properly skipped when windows get destroyed
-            self->priv->windows[i] = NULL;
+            blanking_window = prepare_monitor (self, gdk_display_get_monitor (display, i));
+
+            if (blanking_window != NULL)
+            {
+                g_ptr_array_add (windows, blanking_window);
+            }
         }
     }
 
-    self->priv->blanked = TRUE;
+    map_windows (self, windows);
+
+    _xapp_trace_span (XAPP_TRACE_BLANKING_WINDOW_TIME, trace_start);
+    _xapp_trace_count (XAPP_TRACE_BLANK_CYCLES, 1);
+
+    g_ptr_array_unref (windows);
 }
 
 void
 xapp_monitor_blanker_unblank_monitors (XAppMonitorBlanker *self)
 {
-    int i;
+    GHashTableIter iter;
+    GPtrArray *windows;
+    GtkWidget *window;
+
     g_return_if_fail (XAPP_IS_MONITOR_BLANKER (self));
 
-    if (self->priv->windows == NULL)
+    if (!self->priv->blanked)
         return;
 
-    for (i = 0; i < self->priv->num_outputs; i++)
+    /* A pending blanked is superseded */
+    finish_pending (self);
+    self->priv->request_time = g_get_monotonic_time ();
+
+    windows = g_ptr_array_new ();
+
+    if (self->priv->shaped_window != NULL && gtk_widget_get_mapped (self->priv->shaped_window))
     {
-        if (self->priv->windows[i] != NULL)
+        g_ptr_array_add (windows, self->priv->shaped_window);
+    }
+
+    g_hash_table_iter_init (&iter, self->priv->windows);
+
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &window))
+    {
+        if (gtk_widget_get_mapped (window))
         {
-            gtk_widget_destroy (self->priv->windows[i]);
-            self->priv->windows[i] = NULL;
+            g_ptr_array_add (windows, window);
         }
     }
-    g_free (self->priv->windows);
-    self->priv->windows = NULL;
+
+    untrack_active_window (self);
+    self->priv->blanked = FALSE;
+
+    unmap_windows (self, windows);
+
+    g_ptr_array_unref (windows);
+}
+
+/**
+ * xapp_monitor_blanker_release_windows:
+ * @self: the #XAppMonitorBlanker
+ *
+ * Unblanking keeps the blanking windows around, hidden, so the next
+ * xapp_monitor_blanker_blank_other_monitors() only has to map them again.
+ * This destroys them (unblanking first, if needed), for callers that
+ * won't be blanking again for a while.
+ */
+void
+xapp_monitor_blanker_release_windows (XAppMonitorBlanker *self)
+{
+    g_return_if_fail (XAPP_IS_MONITOR_BLANKER (self));
+
+    finish_pending (self);
+    untrack_active_window (self);
+
+    if (self->priv->shaped_window != NULL)
+    {
+        gtk_widget_destroy (self->priv->shaped_window);
+        self->priv->shaped_window = NULL;
+    }
+
+    g_hash_table_remove_all (self->priv->windows);
     self->priv->blanked = FALSE;
 }
 
+/**
+ * xapp_monitor_blanker_set_single_window:
+ * @self: the #XAppMonitorBlanker
+ * @single_window: whether to blank with a single shaped window
+ *
+ * By default every blanked monitor gets its own window.  In single window
+ * mode one screen-sized window is used instead, with its output and input
+ * shape set to the monitors being blanked - so the number of windows the
+ * X server and compositor deal with doesn't grow with the monitor count.
+ *
+ * If the display doesn't support shaped windows, the per-monitor windows
+ * are used regardless.  Takes effect the next time monitors are blanked.
+ */
+void
+xapp_monitor_blanker_set_single_window (XAppMonitorBlanker *self,
+                                        gboolean            single_window)
+{
+    g_return_if_fail (XAPP_IS_MONITOR_BLANKER (self));
+
+    self->priv->single_window = single_window;
+}
+
+/**
+ * xapp_monitor_blanker_get_single_window:
+ * @self: the #XAppMonitorBlanker
+ *
+ * Returns: whether single window mode is enabled.
+ */
+gboolean
+xapp_monitor_blanker_get_single_window (XAppMonitorBlanker *self)
+{
+    g_return_val_if_fail (XAPP_IS_MONITOR_BLANKER (self), FALSE);
+
+    return self->priv->single_window;
+}
+
+/**
+ * xapp_monitor_blanker_set_zero_paint:
+ * @self: the #XAppMonitorBlanker
+ * @zero_paint: whether to use zero-paint blanking windows
+ *
+ * By default blanking windows are regular styled GTK windows.  Zero-paint
+ * windows skip styling and client-side drawing entirely - the X server
+ * fills them with a black background pixel - and set
+ * _NET_WM_BYPASS_COMPOSITOR so a compositing window manager can leave
+ * them unredirected.  Blanked monitors then cost next to nothing while
+ * something demanding runs on the active one.
+ *
+ * Only supported on X11, other displays get regular windows.  Takes
+ * effect the next time monitors are blanked.
+ */
+void
+xapp_monitor_blanker_set_zero_paint (XAppMonitorBlanker *self,
+                                     gboolean            zero_paint)
+{
+    g_return_if_fail (XAPP_IS_MONITOR_BLANKER (self));
+
+    self->priv->zero_paint = zero_paint;
+}
+
+/**
+ * xapp_monitor_blanker_get_zero_paint:
+ * @self: the #XAppMonitorBlanker
+ *
+ * Returns: whether zero-paint mode is enabled.
+ */
+gboolean
+xapp_monitor_blanker_get_zero_paint (XAppMonitorBlanker *self)
+{
+    g_return_val_if_fail (XAPP_IS_MONITOR_BLANKER (self), FALSE);
+
+    return self->priv->zero_paint;
+}
+
 gboolean
 xapp_monitor_blanker_are_monitors_blanked (XAppMonitorBlanker *self)
 {
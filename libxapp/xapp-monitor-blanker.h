@@ -36,6 +36,13 @@ XAppMonitorBlanker *xapp_monitor_blanker_new                  (void);
 void         xapp_monitor_blanker_blank_other_monitors (XAppMonitorBlanker *self,
                                                 GtkWindow   *window);
 void         xapp_monitor_blanker_unblank_monitors     (XAppMonitorBlanker *self);
+void         xapp_monitor_blanker_release_windows      (XAppMonitorBlanker *self);
+void         xapp_monitor_blanker_set_single_window    (XAppMonitorBlanker *self,
+                                                        gboolean            single_window);
+gboolean     xapp_monitor_blanker_get_single_window    (XAppMonitorBlanker *self);
+void         xapp_monitor_blanker_set_zero_paint       (XAppMonitorBlanker *self,
+                                                        gboolean            zero_paint);
+gboolean     xapp_monitor_blanker_get_zero_paint       (XAppMonitorBlanker *self);
 gboolean     xapp_monitor_blanker_are_monitors_blanked (XAppMonitorBlanker *self);
 
 G_END_DECLS
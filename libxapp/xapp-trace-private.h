@@ -0,0 +1,61 @@
+#ifndef __XAPP_TRACE_PRIVATE_H__
+#define __XAPP_TRACE_PRIVATE_H__
+
+#include <glib.h>
+
+#include "xapp-trace.h"
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+    XAPP_TRACE_RELOADS,
+    XAPP_TRACE_ICONS_RENDERED,
+    XAPP_TRACE_ICON_BYTES_WRITTEN,
+    XAPP_TRACE_ICON_CACHE_HITS,
+    XAPP_TRACE_SURFACE_CACHE_HITS,
+    XAPP_TRACE_BLANK_CYCLES,
+    XAPP_TRACE_GROUP_SWITCHES,
+
+    /* Spans - the total time spent in each, in microseconds */
+    XAPP_TRACE_RELOAD_TIME,
+    XAPP_TRACE_FLAG_LOAD_TIME,
+    XAPP_TRACE_NOTATION_TIME,
+    XAPP_TRACE_ICON_ENCODE_TIME,
+    XAPP_TRACE_ICON_THEME_RESCAN_TIME,
+    XAPP_TRACE_BLANKING_WINDOW_TIME,
+    XAPP_TRACE_SWITCH_LATENCY_TIME,
+
+    XAPP_TRACE_N_COUNTERS
+} XAppTraceCounter;
+
+/* Set once, from XAPP_TRACE, by _xapp_trace_init() */
+extern gboolean _xapp_trace_on;
+
+void   _xapp_trace_init     (void);
+void   _xapp_trace_add      (XAppTraceCounter counter,
+                             guint64          amount);
+void   _xapp_trace_span_end (XAppTraceCounter counter,
+                             gint64           start);
+
+/* Everything is behind a single test of _xapp_trace_on, so tracing costs
+ * nothing more than that when disabled.
+ */
+#define _xapp_trace_count(counter, amount)          \
+    G_STMT_START {                                  \
+        if (G_UNLIKELY (_xapp_trace_on))            \
+            _xapp_trace_add ((counter), (amount));  \
+    } G_STMT_END
+
+#define _xapp_trace_span_begin() \
+    (G_UNLIKELY (_xapp_trace_on) ? g_get_monotonic_time () : 0)
+
+#define _xapp_trace_span(counter, start)                \
+    G_STMT_START {                                      \
+        if (G_UNLIKELY (_xapp_trace_on))                \
+            _xapp_trace_span_end ((counter), (start));  \
+    } G_STMT_END
+
+G_END_DECLS
+
+#endif  /* __XAPP_TRACE_PRIVATE_H__ */
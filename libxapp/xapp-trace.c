@@ -0,0 +1,122 @@
+#include <config.h>
+
+#include <glib.h>
+
+#include "xapp-trace-private.h"
+
+/* Cumulative counters and timed spans for the layout controller and
+ * monitor blanker hot paths.  Enabled by setting XAPP_TRACE in the
+ * environment - every span is then also logged as a debug message, so
+ * G_MESSAGES_DEBUG=XApp gives a timeline of where the time went.
+ */
+
+gboolean _xapp_trace_on = FALSE;
+
+static const gchar * const counter_names[XAPP_TRACE_N_COUNTERS] =
+{
+    "reloads",
+    "icons-rendered",
+    "icon-bytes-written",
+    "icon-cache-hits",
+    "surface-cache-hits",
+    "blank-cycles",
+    "group-switches",
+    "reload-us",
+    "flag-load-us",
+    "notation-us",
+    "icon-encode-us",
+    "icon-theme-rescan-us",
+    "blanking-window-us",
+    "switch-latency-us"
+};
+
+/* Reloads update these from a worker thread */
+static GMutex counters_lock;
+static guint64 counters[XAPP_TRACE_N_COUNTERS];
+
+void
+_xapp_trace_init (void)
+{
+    static gsize initialized = 0;
+
+    if (g_once_init_enter (&initialized))
+    {
+        _xapp_trace_on = g_getenv (XAPP_TRACE_ENV) != NULL;
+
+        g_once_init_leave (&initialized, 1);
+    }
+}
+
+void
+_xapp_trace_add (XAppTraceCounter counter,
+                 guint64          amount)
+{
+    g_mutex_lock (&counters_lock);
+    counters[counter] += amount;
+    g_mutex_unlock (&counters_lock);
+}
+
+void
+_xapp_trace_span_end (XAppTraceCounter counter,
+                      gint64           start)
+{
+    gint64 elapsed = g_get_monotonic_time () - start;
+
+    _xapp_trace_add (counter, elapsed);
+
+    g_debug ("trace: %s +%" G_GINT64_FORMAT " (at %" G_GINT64_FORMAT ")",
+             counter_names[counter], elapsed, start);
+}
+
+/**
+ * xapp_trace_is_enabled:
+ *
+ * Returns: whether tracing was enabled, by setting XAPP_TRACE in the
+ * environment.
+ */
+gboolean
+xapp_trace_is_enabled (void)
+{
+    _xapp_trace_init ();
+
+    return _xapp_trace_on;
+}
+
+/**
+ * xapp_trace_get_counters:
+ *
+ * Returns the cumulative counters of the layout controllers and monitor
+ * blankers in this process - reloads, icons rendered, icon bytes written,
+ * cache hits, group switches and blank cycles - and the total time, in
+ * microseconds, spent in each traced stage (the counters ending in "-us").
+ *
+ * Counters are only kept when tracing is enabled, by setting XAPP_TRACE
+ * in the environment.
+ *
+ * Returns: (transfer full): an a{st} #GVariant, or %NULL if tracing is
+ * disabled.
+ */
+GVariant *
+xapp_trace_get_counters (void)
+{
+    GVariantBuilder builder;
+    gint i;
+
+    if (!xapp_trace_is_enabled ())
+    {
+        return NULL;
+    }
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{st}"));
+
+    g_mutex_lock (&counters_lock);
+
+    for (i = 0; i < XAPP_TRACE_N_COUNTERS; i++)
+    {
+        g_variant_builder_add (&builder, "{st}", counter_names[i], counters[i]);
+    }
+
+    g_mutex_unlock (&counters_lock);
+
+    return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
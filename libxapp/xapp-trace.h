@@ -0,0 +1,15 @@
+#ifndef __XAPP_TRACE_H__
+#define __XAPP_TRACE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define XAPP_TRACE_ENV "XAPP_TRACE"
+
+gboolean  xapp_trace_is_enabled   (void);
+GVariant *xapp_trace_get_counters (void);
+
+G_END_DECLS
+
+#endif  /* __XAPP_TRACE_H__ */